@@ -0,0 +1,283 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HOWLER_USE_NEON
+#endif
+
+/*******************************************************************************
+ *
+ * Layout
+ *
+ ******************************************************************************/
+
+static int valid_region(const howler_ambient_region *r) {
+  return r->x >= 0.0f && r->y >= 0.0f && r->width > 0.0f && r->height > 0.0f &&
+         r->x + r->width <= 1.0f && r->y + r->height <= 1.0f;
+}
+
+int howler_ambient_layout_load(howler_ambient_layout *layout, const char *path) {
+  if(!layout || !path) { return HOWLER_ERROR_INVALID_PTR; }
+  memset(layout, 0, sizeof(*layout));
+
+  FILE *fp = fopen(path, "r");
+  if(!fp) {
+    fprintf(stderr, "ERROR: Unable to open layout %s\n", path);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  int err = HOWLER_SUCCESS;
+  int line_number = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), fp)) {
+    line_number++;
+
+    char *comment = strchr(line, '#');
+    if(comment) {
+      *comment = '\0';
+    }
+
+    char name[16];
+    float v[4];
+    int n = sscanf(line, "%15s %f %f %f %f", name, &v[0], &v[1], &v[2], &v[3]);
+    if(n <= 0) {
+      continue;
+    }
+
+    if(strcmp(name, "smoothing") == 0 && n == 2 &&
+       v[0] >= 0.0f && v[0] < 1.0f) {
+      layout->smoothing = v[0];
+      continue;
+    }
+
+    int led = howler_parse_led_name(name);
+    howler_ambient_region region = { v[0], v[1], v[2], v[3] };
+    if(led < 0 || n != 5 || !valid_region(&region)) {
+      fprintf(stderr, "ERROR: %s:%d: expected 'smoothing S' or a control (J#, B#, "
+              "H#) followed by x, y, width and height as fractions of the "
+              "screen\n", path, line_number);
+      err = HOWLER_ERROR_INVALID_PARAMS;
+      break;
+    }
+
+    layout->regions[led] = region;
+    layout->mapped[led] = 1;
+  }
+
+  fclose(fp);
+  return err;
+}
+
+/*******************************************************************************
+ *
+ * Sampling
+ *
+ ******************************************************************************/
+
+int howler_ambient_init(howler_ambient *amb, const howler_ambient_layout *layout,
+                        unsigned int width, unsigned int height, size_t stride) {
+  if(!amb || !layout) { return HOWLER_ERROR_INVALID_PTR; }
+  if(!width || !height || stride < 3 * (size_t)width) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  memset(amb, 0, sizeof(*amb));
+  amb->layout = *layout;
+  amb->width = width;
+  amb->height = height;
+  amb->stride = stride;
+
+  // Weight of each new sample out of 256.
+  amb->alpha = (unsigned int)((1.0f - layout->smoothing) * 256.0f + 0.5f);
+  if(amb->alpha < 1) { amb->alpha = 1; }
+  if(amb->alpha > 256) { amb->alpha = 256; }
+
+  int i = 0;
+  for(; i < HOWLER_NUM_LEDS; i++) {
+    if(!layout->mapped[i]) {
+      continue;
+    }
+
+    const howler_ambient_region *r = &(layout->regions[i]);
+    howler_ambient_rect *rect = &(amb->rects[i]);
+    rect->x0 = (unsigned int)(r->x * width);
+    rect->y0 = (unsigned int)(r->y * height);
+    rect->x1 = (unsigned int)((r->x + r->width) * width + 0.5f);
+    rect->y1 = (unsigned int)((r->y + r->height) * height + 0.5f);
+
+    // Every region samples at least one pixel, however small the screen.
+    if(rect->x1 > width) { rect->x1 = width; }
+    if(rect->y1 > height) { rect->y1 = height; }
+    if(rect->x0 >= rect->x1) { rect->x0 = rect->x1 - 1; }
+    if(rect->y0 >= rect->y1) { rect->y0 = rect->y1 - 1; }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+#if defined(__SSE2__)
+/* The channel of byte i in 48 bytes of packed RGB is i % 3. Masking each of
+ * the three registers by channel and summing with psadbw adds up sixteen
+ * pixels of each channel without unpacking them. */
+static const unsigned char kChannelMasks[3][3][16] = {
+  {
+    { 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00,
+      0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF },
+    { 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00,
+      0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00 },
+    { 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF,
+      0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00 }
+  },
+  {
+    { 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF,
+      0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00 },
+    { 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00,
+      0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF },
+    { 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00,
+      0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00 }
+  },
+  {
+    { 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00,
+      0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00 },
+    { 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF,
+      0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00 },
+    { 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00,
+      0x00, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF }
+  }
+};
+#endif
+
+/* Adds the channels of the pixels of one row of a region to sum. */
+static void sum_row(uint64_t *sum, const unsigned char *px, unsigned int n) {
+  unsigned int i = 0;
+
+#if defined(__SSE2__)
+  __m128i mask[3][3];
+  int c = 0, k = 0;
+  for(c = 0; c < 3; c++) {
+    for(k = 0; k < 3; k++) {
+      mask[c][k] = _mm_loadu_si128((const __m128i *)kChannelMasks[c][k]);
+    }
+  }
+
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc[3] = { zero, zero, zero };
+  for(; i + 16 <= n; i += 16, px += 48) {
+    __m128i v[3];
+    for(k = 0; k < 3; k++) {
+      v[k] = _mm_loadu_si128((const __m128i *)(px + 16 * k));
+    }
+
+    for(c = 0; c < 3; c++) {
+      for(k = 0; k < 3; k++) {
+        acc[c] = _mm_add_epi64(acc[c], _mm_sad_epu8(_mm_and_si128(v[k], mask[c][k]), zero));
+      }
+    }
+  }
+
+  for(c = 0; c < 3; c++) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc[c]);
+    sum[c] += lanes[0] + lanes[1];
+  }
+#elif defined(HOWLER_USE_NEON)
+  // Each sixteen bit lane gains two pixels of a channel per step, so the
+  // lanes are widened every 128 steps before they can overflow.
+  while(i + 16 <= n) {
+    uint16x8_t acc16[3] = { vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0) };
+    unsigned int end = i + 16 * 128;
+    for(; i + 16 <= n && i < end; i += 16, px += 48) {
+      uint8x16x3_t v = vld3q_u8(px);
+      acc16[0] = vpadalq_u8(acc16[0], v.val[0]);
+      acc16[1] = vpadalq_u8(acc16[1], v.val[1]);
+      acc16[2] = vpadalq_u8(acc16[2], v.val[2]);
+    }
+
+    int c = 0;
+    for(; c < 3; c++) {
+      sum[c] += vaddlvq_u16(acc16[c]);
+    }
+  }
+#endif
+
+  for(; i < n; i++, px += 3) {
+    sum[0] += px[0];
+    sum[1] += px[1];
+    sum[2] += px[2];
+  }
+}
+
+void howler_ambient_sample(howler_ambient *amb, const unsigned char *rgb,
+                           howler_led *frame) {
+  int i = 0;
+  for(; i < HOWLER_NUM_LEDS; i++) {
+    if(!amb->layout.mapped[i]) {
+      continue;
+    }
+
+    const howler_ambient_rect *rect = &(amb->rects[i]);
+    unsigned int w = rect->x1 - rect->x0;
+    uint64_t sum[3] = { 0, 0, 0 };
+    unsigned int y = rect->y0;
+    for(; y < rect->y1; y++) {
+      sum_row(sum, rgb + y * amb->stride + 3 * rect->x0, w);
+    }
+
+    uint64_t count = (uint64_t)w * (rect->y1 - rect->y0);
+    int c = 0;
+    for(; c < 3; c++) {
+      // Smoothed values carry eight fractional bits.
+      unsigned int target = (unsigned int)((sum[c] << 8) / count);
+      unsigned int prev = amb->smoothed[i][c];
+      if(amb->primed) {
+        target = prev + (((int)target - (int)prev) * (int)amb->alpha) / 256;
+      }
+
+      amb->smoothed[i][c] = (uint16_t)target;
+      frame[i].channels[c] = (howler_led_channel)((target + 128) >> 8);
+    }
+  }
+
+  amb->primed = 1;
+}
+
+int howler_ambient_commit(howler_device *dev, howler_ambient *amb,
+                          const unsigned char *rgb) {
+  if(!dev || !amb || !rgb) { return HOWLER_ERROR_INVALID_PTR; }
+
+  // LEDs without a region keep whatever they were last set to.
+  howler_led_frame frame;
+  howler_get_led_frame(frame, dev);
+  howler_ambient_sample(amb, rgb, frame);
+  return howler_commit_led_frame(dev, frame);
+}
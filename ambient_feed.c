@@ -0,0 +1,214 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* howler-ambient drives the LEDs of a device from video frames, using a
+ * layout that gives each LED a region of the screen (see
+ * howler_ambient_layout_load). Frames are packed 8-bit RGB, either read one
+ * after another from standard input, e.g.
+ *
+ *     ffmpeg -i video.mkv -f rawvideo -pix_fmt rgb24 - | \
+ *       howler-ambient layout.txt 1920 1080
+ *
+ * or sampled 60 times a second from a shared memory file that another
+ * process keeps up to date. */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "howler.h"
+
+static const uint64_t kSharedMemoryPeriodNs = 1000000000ULL / 60;
+
+static volatile sig_atomic_t gStop = 0;
+
+static void handle_signal(int sig) {
+  (void)sig;
+  gStop = 1;
+}
+
+static void print_usage() {
+  printf("Usage: howler-ambient LAYOUT WIDTH HEIGHT [INPUT] [DEVICE]\n");
+  printf("\n");
+  printf("    LAYOUT is the file giving each LED its region of the screen\n");
+  printf("    WIDTH and HEIGHT are the size of the frames in pixels\n");
+  printf("    INPUT is '-' (default) to read frames from standard input, or\n");
+  printf("        the path of a shared memory file holding the latest frame\n");
+  printf("    DEVICE is the index of the device to light (default 0)\n");
+}
+
+static void print_stats(unsigned long long frames, uint64_t sample_ns) {
+  if(!frames) {
+    return;
+  }
+
+  printf("%llu frames, %.1f us per frame to sample\n", frames,
+         (double)sample_ns / frames / 1000.0);
+}
+
+static int run_pipe(howler_context *ctx, howler_device *dev,
+                    howler_ambient *amb, size_t frame_size) {
+  unsigned char *rgb = malloc(frame_size);
+  if(!rgb) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  unsigned long long frames = 0;
+  uint64_t sample_ns = 0;
+  int err = 0;
+  while(!gStop && err == 0 && fread(rgb, frame_size, 1, stdin) == 1) {
+    uint64_t start = howler_get_time_ns();
+    err = howler_ambient_commit(dev, amb, rgb);
+    sample_ns += howler_get_time_ns() - start;
+    frames++;
+
+    // Completes the bank writes of the previous frame without waiting.
+    if(err == 0) {
+      err = howler_handle_events(ctx, 0);
+    }
+  }
+
+  print_stats(frames, sample_ns);
+  free(rgb);
+  return err;
+}
+
+static int run_shared_memory(howler_context *ctx, howler_device *dev,
+                             howler_ambient *amb, const char *path,
+                             size_t frame_size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "Unable to open %s\n", path);
+    return -1;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || (size_t)st.st_size < frame_size) {
+    fprintf(stderr, "%s is smaller than a frame\n", path);
+    close(fd);
+    return -1;
+  }
+
+  void *rgb = mmap(NULL, frame_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(rgb == MAP_FAILED) {
+    fprintf(stderr, "Unable to map %s\n", path);
+    return -1;
+  }
+
+  unsigned long long frames = 0;
+  uint64_t sample_ns = 0;
+  uint64_t next = howler_get_time_ns();
+  int err = 0;
+  while(!gStop && err == 0) {
+    uint64_t now = howler_get_time_ns();
+    if(now >= next) {
+      err = howler_ambient_commit(dev, amb, (const unsigned char *)rgb);
+      sample_ns += howler_get_time_ns() - now;
+      frames++;
+
+      next += kSharedMemoryPeriodNs;
+      if(next < now) {
+        next = now + kSharedMemoryPeriodNs;
+      }
+      continue;
+    }
+
+    err = howler_handle_events(ctx, (int)((next - now + 999999) / 1000000));
+  }
+
+  print_stats(frames, sample_ns);
+  munmap(rgb, frame_size);
+  return err;
+}
+
+int main(int argc, const char **argv) {
+  if(argc < 4) {
+    print_usage();
+    return 1;
+  }
+
+  unsigned int width, height;
+  if(sscanf(argv[2], "%u", &width) != 1 || sscanf(argv[3], "%u", &height) != 1 ||
+     !width || !height) {
+    fprintf(stderr, "Invalid frame size: %s x %s\n", argv[2], argv[3]);
+    return 1;
+  }
+
+  const char *input = (argc > 4)? argv[4] : "-";
+  int device_idx = 0;
+  if(argc > 5 && sscanf(argv[5], "%d", &device_idx) != 1) {
+    fprintf(stderr, "Invalid device index: %s\n", argv[5]);
+    return 1;
+  }
+
+  howler_ambient_layout layout;
+  if(howler_ambient_layout_load(&layout, argv[1]) < 0) {
+    return 1;
+  }
+
+  howler_ambient amb;
+  size_t stride = 3 * (size_t)width;
+  if(howler_ambient_init(&amb, &layout, width, height, stride) < 0) {
+    fprintf(stderr, "Unable to fit the layout to the frame size\n");
+    return 1;
+  }
+
+  howler_context *ctx;
+  if(howler_init(&ctx) < 0) {
+    return 1;
+  }
+
+  howler_device *dev = howler_get_device(ctx, device_idx);
+  if(!dev) {
+    fprintf(stderr, "Unable to open device %d\n", device_idx);
+    howler_destroy(ctx);
+    return 1;
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  int err;
+  if(strcmp(input, "-") == 0) {
+    err = run_pipe(ctx, dev, &amb, stride * height);
+  } else {
+    err = run_shared_memory(ctx, dev, &amb, input, stride * height);
+  }
+
+  // Let the last frame reach the device.
+  while(dev->frame_pacer.pending || dev->frame_pacer.in_flight) {
+    if(howler_handle_events(ctx, 10) < 0) {
+      break;
+    }
+  }
+
+  howler_destroy(ctx);
+  return (err < 0)? 1 : 0;
+}
@@ -0,0 +1,347 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <libusb.h>
+#include <stdio.h>
+#include <string.h>
+
+/*******************************************************************************
+ *
+ * Transfers
+ *
+ ******************************************************************************/
+
+static const unsigned char kCommandOutEndpoint = 0x02;
+static const unsigned char kCommandInEndpoint = 0x81;
+static const int kCommandInterface = 0;
+
+static void start_next_command(howler_device *dev);
+
+static int claim_command_interface(howler_device *dev) {
+  howler_command_queue *q = &(dev->commands);
+  if(q->interface_claimed) {
+    return HOWLER_SUCCESS;
+  }
+
+  libusb_device_handle *handle = (libusb_device_handle *)(dev->usb_handle);
+  int err = libusb_kernel_driver_active(handle, kCommandInterface);
+  if(err < 0) {
+    return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+  }
+
+  q->kernel_driver_attached = 0;
+  if(err) {
+    if(libusb_detach_kernel_driver(handle, kCommandInterface) < 0) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+    q->kernel_driver_attached = 1;
+  }
+
+  if(libusb_claim_interface(handle, kCommandInterface) < 0) {
+    if(q->kernel_driver_attached) {
+      libusb_attach_kernel_driver(handle, kCommandInterface);
+      q->kernel_driver_attached = 0;
+    }
+    return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+  }
+
+  q->interface_claimed = 1;
+  return HOWLER_SUCCESS;
+}
+
+static void release_command_interface(howler_device *dev) {
+  howler_command_queue *q = &(dev->commands);
+  if(!q->interface_claimed) {
+    return;
+  }
+
+  libusb_device_handle *handle = (libusb_device_handle *)(dev->usb_handle);
+  libusb_release_interface(handle, kCommandInterface);
+  if(q->kernel_driver_attached) {
+    libusb_attach_kernel_driver(handle, kCommandInterface);
+    q->kernel_driver_attached = 0;
+  }
+  q->interface_claimed = 0;
+}
+
+/* Reports the result of the current command and moves on to the next one. */
+static void complete_command(howler_device *dev, int status,
+                             const unsigned char *response) {
+  howler_command_queue *q = &(dev->commands);
+  howler_command done = q->current;
+  q->count--;
+  q->in_flight = 0;
+  HOWLER_SPAN_END(q->command_start_ns, "async_command", done.cmd[1]);
+  if(status == HOWLER_SUCCESS) {
+    howler_latency_histogram_add(&(dev->transfer_stats.command_latency),
+                                 howler_get_time_ns() - q->command_start_ns);
+  }
+  q->command_start_ns = 0;
+
+  // A bank write that never made it leaves led_banks ahead of the device,
+  // whichever command the caller attached its callback to.
+  unsigned char bank = done.cmd[2] - 1;
+  if(status < 0 && done.cmd[1] == CMD_SET_RGB_LED_BANK && bank < 6) {
+    dev->failed_banks |= 1 << bank;
+  }
+
+  if(done.callback) {
+    done.callback(dev, status, response, done.user_data);
+  }
+
+  start_next_command(dev);
+}
+
+/* Counts a transfer that finished with status, where a submission that
+ * failed counts as a failed transfer. Cancellations are not counted. */
+static void count_transfer(howler_device *dev, int status) {
+  if(status == LIBUSB_TRANSFER_CANCELLED) {
+    return;
+  }
+
+  dev->transfer_stats.transfers++;
+  if(status != LIBUSB_TRANSFER_COMPLETED) {
+    dev->transfer_stats.failures++;
+  }
+}
+
+static void command_in_cb(struct libusb_transfer *transfer) {
+  howler_device *dev = (howler_device *)(transfer->user_data);
+  howler_command_queue *q = &(dev->commands);
+  howler_record_frame(dev, HOWLER_TRACE_RESPONSE, howler_get_time_ns(),
+                      transfer->status == LIBUSB_TRANSFER_COMPLETED? 0 :
+                      HOWLER_ERROR_LIBUSB_TRANSFER_ERROR, q->response);
+  count_transfer(dev, transfer->status);
+
+  if(transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    complete_command(dev, HOWLER_SUCCESS, dev->commands.response);
+  } else if(transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+    complete_command(dev, HOWLER_ERROR_CANCELLED, NULL);
+  } else {
+    complete_command(dev, HOWLER_ERROR_LIBUSB_TRANSFER_ERROR, NULL);
+  }
+}
+
+static void command_out_cb(struct libusb_transfer *transfer) {
+  howler_device *dev = (howler_device *)(transfer->user_data);
+  howler_command_queue *q = &(dev->commands);
+  howler_record_frame(dev, HOWLER_TRACE_COMMAND, q->command_start_ns,
+                      transfer->status == LIBUSB_TRANSFER_COMPLETED? 0 :
+                      HOWLER_ERROR_LIBUSB_TRANSFER_ERROR, transfer->buffer);
+  count_transfer(dev, transfer->status);
+
+  if(transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+    complete_command(dev, HOWLER_ERROR_CANCELLED, NULL);
+    return;
+  }
+
+  if(transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+    complete_command(dev, HOWLER_ERROR_LIBUSB_TRANSFER_ERROR, NULL);
+    return;
+  }
+
+  if(!q->current.expects_response || q->cancelling) {
+    complete_command(dev, HOWLER_SUCCESS, NULL);
+    return;
+  }
+
+  memset(q->response, 0, sizeof(q->response));
+  if(libusb_submit_transfer((struct libusb_transfer *)q->in_transfer) < 0) {
+    count_transfer(dev, LIBUSB_TRANSFER_ERROR);
+    complete_command(dev, HOWLER_ERROR_LIBUSB_TRANSFER_ERROR, NULL);
+  }
+}
+
+int howler_alloc_command_transfers(howler_device *dev) {
+  howler_command_queue *q = &(dev->commands);
+  libusb_device_handle *handle = (libusb_device_handle *)(dev->usb_handle);
+
+  if(!q->out_transfer) {
+    struct libusb_transfer *out = libusb_alloc_transfer(0);
+    if(!out) {
+      fprintf(stderr, "Error allocating libusb_transfer struct.\n");
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+
+    // The buffer is pointed at the head of the queue before every submission.
+    libusb_fill_interrupt_transfer(out, handle, kCommandOutEndpoint, NULL,
+                                   HOWLER_COMMAND_SIZE, command_out_cb, dev, 0);
+    q->out_transfer = out;
+  }
+
+  if(!q->in_transfer) {
+    struct libusb_transfer *in = libusb_alloc_transfer(0);
+    if(!in) {
+      fprintf(stderr, "Error allocating libusb_transfer struct.\n");
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+
+    libusb_fill_interrupt_transfer(in, handle, kCommandInEndpoint, q->response,
+                                   HOWLER_COMMAND_SIZE, command_in_cb, dev, 0);
+    q->in_transfer = in;
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+static void start_next_command(howler_device *dev) {
+  howler_command_queue *q = &(dev->commands);
+
+  // Completing a command with an error calls back into here, so this only
+  // needs to start one.
+  if(q->in_flight) {
+    return;
+  }
+
+  if(!howler_command_queue_pop(q, &(q->current))) {
+    release_command_interface(dev);
+    return;
+  }
+
+  int err = HOWLER_ERROR_CANCELLED;
+  if(!q->cancelling) {
+    err = claim_command_interface(dev);
+  }
+
+  if(err == HOWLER_SUCCESS) {
+    struct libusb_transfer *out = (struct libusb_transfer *)q->out_transfer;
+    out->buffer = q->current.cmd;
+    q->command_start_ns = howler_get_time_ns();
+    if(libusb_submit_transfer(out) < 0) {
+      count_transfer(dev, LIBUSB_TRANSFER_ERROR);
+      err = HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+  }
+
+  q->in_flight = 1;
+  if(err < 0) {
+    complete_command(dev, err, NULL);
+  }
+}
+
+/*******************************************************************************
+ *
+ * Queue
+ *
+ ******************************************************************************/
+
+int howler_submit_command(howler_device *dev, const unsigned char *cmd,
+                          int expects_response,
+                          howler_command_callback callback, void *user_data) {
+  if(!cmd) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  return howler_submit_command_with_priority(
+    dev, howler_command_default_priority(cmd), cmd, expects_response,
+    callback, user_data);
+}
+
+int howler_submit_command_with_priority(howler_device *dev,
+                                        howler_command_priority priority,
+                                        const unsigned char *cmd,
+                                        int expects_response,
+                                        howler_command_callback callback,
+                                        void *user_data) {
+  if(!dev || !dev->usb_handle || !cmd) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  if(priority >= HOWLER_NUM_COMMAND_PRIORITIES) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  howler_command entry;
+  memcpy(entry.cmd, cmd, HOWLER_COMMAND_SIZE);
+  entry.expects_response = expects_response;
+  entry.callback = callback;
+  entry.user_data = user_data;
+
+  int err = howler_command_queue_push(&(dev->commands), priority, &entry);
+  if(err < 0) {
+    return err;
+  }
+
+  start_next_command(dev);
+  return HOWLER_SUCCESS;
+}
+
+size_t howler_pending_commands(const howler_device *dev) {
+  return dev? dev->commands.count : 0;
+}
+
+int howler_flush_commands(howler_device *dev) {
+  if(!dev) { return HOWLER_ERROR_INVALID_PTR; }
+
+  libusb_context *usb_ctx = (libusb_context *)(dev->ctx->usb_ctx);
+  while(dev->commands.count > 0) {
+    int err = libusb_handle_events(usb_ctx);
+    if(err < 0 && err != LIBUSB_ERROR_INTERRUPTED) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+int howler_wait_for_queue_space(howler_device *dev,
+                                howler_command_priority priority) {
+  libusb_context *usb_ctx = (libusb_context *)(dev->ctx->usb_ctx);
+  while(howler_command_queue_space(dev, priority) == 0) {
+    int err = libusb_handle_events(usb_ctx);
+    if(err < 0 && err != LIBUSB_ERROR_INTERRUPTED) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+void howler_cancel_commands(howler_device *dev) {
+  howler_command_queue *q = &(dev->commands);
+  if(q->count > 0) {
+    q->cancelling = 1;
+
+    // Whichever transfer is on the wire comes back through its callback,
+    // which fails the rest of the queue.
+    libusb_cancel_transfer((struct libusb_transfer *)q->out_transfer);
+    libusb_cancel_transfer((struct libusb_transfer *)q->in_transfer);
+    howler_flush_commands(dev);
+    q->cancelling = 0;
+  }
+}
+
+void howler_free_command_transfers(howler_device *dev) {
+  howler_command_queue *q = &(dev->commands);
+  if(q->out_transfer) {
+    libusb_free_transfer((struct libusb_transfer *)q->out_transfer);
+    q->out_transfer = NULL;
+  }
+
+  if(q->in_transfer) {
+    libusb_free_transfer((struct libusb_transfer *)q->in_transfer);
+    q->in_transfer = NULL;
+  }
+}
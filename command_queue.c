@@ -0,0 +1,156 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+
+howler_command_priority howler_command_default_priority(const unsigned char *cmd) {
+  switch(cmd[1]) {
+    case CMD_SET_INPUT:
+    case CMD_GET_INPUT:
+      return HOWLER_PRIORITY_INPUT;
+
+    case CMD_SET_RGB_LED:
+    case CMD_SET_INDIVIDUAL_LED:
+    case CMD_SET_RGB_LED_BANK:
+      return HOWLER_PRIORITY_LED;
+
+    case CMD_GET_RGB_LED:
+      return HOWLER_PRIORITY_READBACK;
+
+    default:
+      return HOWLER_PRIORITY_CONTROL;
+  }
+}
+
+int howler_command_queue_push(howler_command_queue *q,
+                              howler_command_priority priority,
+                              const howler_command *cmd) {
+  howler_command_ring *ring = &(q->rings[priority]);
+  if(ring->count == HOWLER_COMMAND_QUEUE_DEPTH) {
+    return HOWLER_ERROR_QUEUE_FULL;
+  }
+
+  howler_command *entry =
+    &(ring->entries[(ring->head + ring->count) % HOWLER_COMMAND_QUEUE_DEPTH]);
+  *entry = *cmd;
+  entry->sequence = q->next_sequence++;
+  ring->count++;
+  q->count++;
+  return HOWLER_SUCCESS;
+}
+
+/* Readbacks have to observe every write submitted before them, so they wait
+ * until nothing older is queued in another class. */
+static int is_eligible(const howler_command_queue *q, int priority) {
+  const howler_command_ring *ring = &(q->rings[priority]);
+  if(ring->count == 0) {
+    return 0;
+  }
+
+  if(priority != HOWLER_PRIORITY_READBACK) {
+    return 1;
+  }
+
+  uint64_t sequence = ring->entries[ring->head].sequence;
+  int i = 0;
+  for(; i < HOWLER_NUM_COMMAND_PRIORITIES; i++) {
+    const howler_command_ring *other = &(q->rings[i]);
+    if(i != priority && other->count > 0 &&
+       other->entries[other->head].sequence < sequence) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int howler_command_queue_pop(howler_command_queue *q, howler_command *out) {
+  int chosen = -1;
+  int starving = -1;
+
+  int i = 0;
+  for(; i < HOWLER_NUM_COMMAND_PRIORITIES; i++) {
+    if(!is_eligible(q, i)) {
+      continue;
+    }
+
+    if(chosen < 0) {
+      chosen = i;
+    }
+
+    if(q->rings[i].bypassed >= HOWLER_COMMAND_MAX_BYPASS &&
+       (starving < 0 || q->rings[i].bypassed > q->rings[starving].bypassed)) {
+      starving = i;
+    }
+  }
+
+  if(chosen < 0) {
+    return 0;
+  }
+
+  if(starving >= 0) {
+    chosen = starving;
+  }
+
+  for(i = 0; i < HOWLER_NUM_COMMAND_PRIORITIES; i++) {
+    if(i != chosen && is_eligible(q, i)) {
+      q->rings[i].bypassed++;
+    }
+  }
+
+  howler_command_ring *ring = &(q->rings[chosen]);
+  *out = ring->entries[ring->head];
+  ring->head = (ring->head + 1) % HOWLER_COMMAND_QUEUE_DEPTH;
+  ring->count--;
+  ring->bypassed = 0;
+  return 1;
+}
+
+size_t howler_command_queue_space(const howler_device *dev,
+                                  howler_command_priority priority) {
+  if(!dev || priority >= HOWLER_NUM_COMMAND_PRIORITIES) {
+    return 0;
+  }
+  return HOWLER_COMMAND_QUEUE_DEPTH - dev->commands.rings[priority].count;
+}
+
+void howler_command_queue_forget(howler_command_queue *q,
+                                 const void *user_data) {
+  if(q->in_flight && q->current.user_data == user_data) {
+    q->current.callback = NULL;
+  }
+
+  int i = 0;
+  for(; i < HOWLER_NUM_COMMAND_PRIORITIES; i++) {
+    howler_command_ring *ring = &(q->rings[i]);
+    unsigned int j = 0;
+    for(; j < ring->count; j++) {
+      howler_command *entry =
+        &(ring->entries[(ring->head + j) % HOWLER_COMMAND_QUEUE_DEPTH]);
+      if(entry->user_data == user_data) {
+        entry->callback = NULL;
+      }
+    }
+  }
+}
@@ -0,0 +1,177 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <string.h>
+
+// How often inputs with pending integrator changes are resampled.
+static const uint64_t kIntegratorSamplePeriodNs = 1000000ULL;
+
+int howler_set_input_debounce(howler_device *dev, howler_input ipt,
+                              howler_debounce_mode mode, unsigned int param) {
+  if(!dev) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  if(ipt < eHowlerInput_FIRST || ipt > eHowlerInput_LAST) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  // Check the mode before touching the state, so that a bad call leaves the
+  // current configuration in place.
+  switch(mode) {
+    case HOWLER_DEBOUNCE_NONE:
+    case HOWLER_DEBOUNCE_TIME:
+      break;
+
+    case HOWLER_DEBOUNCE_INTEGRATOR:
+      if(param < 1 || param > 7) {
+        return HOWLER_ERROR_INVALID_PARAMS;
+      }
+      break;
+
+    default:
+      return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  howler_debounce_state *d = &(dev->debounce);
+  howler_input_mask bit = ((howler_input_mask)1) << ipt;
+
+  // Start from a clean slate for this input.
+  d->time_mask &= ~bit;
+  d->integrator_mask &= ~bit;
+  d->locked &= ~bit;
+
+  int i = 0;
+  for(; i < 3; i++) {
+    d->threshold[i] &= ~bit;
+    d->count[i] &= ~bit;
+  }
+
+  switch(mode) {
+    case HOWLER_DEBOUNCE_NONE:
+      break;
+
+    case HOWLER_DEBOUNCE_TIME:
+      d->time_mask |= bit;
+      d->hold_off_ns[ipt] = (uint64_t)param * 1000000ULL;
+      break;
+
+    case HOWLER_DEBOUNCE_INTEGRATOR:
+      d->integrator_mask |= bit;
+      for(i = 0; i < 3; i++) {
+        if((param >> i) & 1) {
+          d->threshold[i] |= bit;
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+static void release_expired_locks(howler_debounce_state *d, uint64_t now_ns) {
+  uint64_t next = 0;
+  howler_input_mask bits = d->locked;
+  while(bits) {
+    int ipt = __builtin_ctzll(bits);
+    bits &= bits - 1;
+
+    if(now_ns >= d->unlock_ns[ipt]) {
+      d->locked &= ~(((howler_input_mask)1) << ipt);
+    } else if(!next || d->unlock_ns[ipt] < next) {
+      next = d->unlock_ns[ipt];
+    }
+  }
+  d->next_unlock_ns = next;
+}
+
+howler_input_mask howler_debounce_update(howler_device *dev,
+                                         howler_input_mask raw,
+                                         uint64_t now_ns) {
+  howler_debounce_state *d = &(dev->debounce);
+  howler_input_mask stable = dev->input_state;
+  howler_input_mask delta = raw ^ stable;
+
+  // Inputs without debouncing follow the report directly.
+  howler_input_mask accept = delta & ~(d->time_mask | d->integrator_mask);
+
+  // Time based: take the edge right away unless we're still holding off
+  // from the previous one.
+  if(d->locked && now_ns >= d->next_unlock_ns) {
+    release_expired_locks(d, now_ns);
+  }
+
+  howler_input_mask timed = delta & d->time_mask & ~(d->locked);
+  accept |= timed;
+  while(timed) {
+    int ipt = __builtin_ctzll(timed);
+    timed &= timed - 1;
+
+    d->locked |= ((howler_input_mask)1) << ipt;
+    d->unlock_ns[ipt] = now_ns + d->hold_off_ns[ipt];
+    if(!d->next_unlock_ns || d->unlock_ns[ipt] < d->next_unlock_ns) {
+      d->next_unlock_ns = d->unlock_ns[ipt];
+    }
+  }
+
+  // Integrator: a three bit vertical counter per input that counts the
+  // samples that disagree with the stable state and resets when they agree.
+  howler_input_mask pending = delta & d->integrator_mask;
+  howler_input_mask *c = d->count;
+  c[0] &= pending;
+  c[1] &= pending;
+  c[2] &= pending;
+
+  howler_input_mask carry = pending;
+  howler_input_mask t = c[0] & carry; c[0] ^= carry; carry = t;
+  t = c[1] & carry; c[1] ^= carry; carry = t;
+  c[2] ^= carry;
+
+  howler_input_mask reached = pending &
+    ~(c[0] ^ d->threshold[0]) &
+    ~(c[1] ^ d->threshold[1]) &
+    ~(c[2] ^ d->threshold[2]);
+
+  c[0] &= ~reached;
+  c[1] &= ~reached;
+  c[2] &= ~reached;
+  accept |= reached;
+
+  d->next_sample_ns = (pending & ~reached)? now_ns + kIntegratorSamplePeriodNs : 0;
+
+  return stable ^ accept;
+}
+
+uint64_t howler_debounce_deadline(const howler_device *dev) {
+  const howler_debounce_state *d = &(dev->debounce);
+  uint64_t deadline = d->locked? d->next_unlock_ns : 0;
+  if(d->next_sample_ns && (!deadline || d->next_sample_ns < deadline)) {
+    deadline = d->next_sample_ns;
+  }
+  return deadline;
+}
@@ -0,0 +1,160 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+  int verify;
+  int errors;
+  int mismatches;
+} save_state;
+
+/* A default waiting to be written, and the bytes the device should echo. */
+typedef struct {
+  save_state *state;
+  unsigned char cmd[6];
+} pending_default;
+
+static void default_written(howler_device *dev, int status,
+                            const unsigned char *response, void *user_data) {
+  (void)dev;
+  pending_default *p = (pending_default *)user_data;
+  if(status < 0) {
+    p->state->errors++;
+    return;
+  }
+
+  if(p->state->verify && (!response || memcmp(response, p->cmd, 6) != 0)) {
+    p->state->mismatches++;
+  }
+}
+
+static int queue_default(howler_device *dev, pending_default *p) {
+  // The queue only holds HOWLER_COMMAND_QUEUE_DEPTH commands of a class, so
+  // this waits for room whenever the class fills up, but not for LED frames
+  // or anything else queued meanwhile.
+  int err = howler_wait_for_queue_space(dev, HOWLER_PRIORITY_CONTROL);
+  if(err < 0) {
+    return err;
+  }
+
+  unsigned char cmd_buf[HOWLER_COMMAND_SIZE];
+  memset(cmd_buf, 0, sizeof(cmd_buf));
+  memcpy(cmd_buf, p->cmd, sizeof(p->cmd));
+  return howler_submit_command_with_priority(dev, HOWLER_PRIORITY_CONTROL,
+                                             cmd_buf, p->state->verify,
+                                             default_written, p);
+}
+
+int howler_save_defaults(howler_device *dev, unsigned int what, int verify) {
+  if(!dev) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  if(!(what & HOWLER_DEFAULTS_ALL)) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  save_state state;
+  state.verify = verify;
+  state.errors = 0;
+  state.mismatches = 0;
+
+  pending_default pending[HOWLER_NUM_LEDS + HOWLER_NUM_INPUTS];
+  size_t nPending = 0;
+
+  if(what & HOWLER_DEFAULTS_LEDS) {
+    // The defaults are shown without any color correction from the host, or
+    // any global brightness, so they are taken from the hardware banks as
+    // dimmed by the brightness last sent.
+    howler_led_frame frame;
+    howler_led_banks_to_frame(frame, (const howler_led_bank *)dev->led_banks);
+    unsigned int level = dev->brightness.sent;
+
+    int i = 0;
+    for(; i < HOWLER_NUM_LEDS; i++) {
+      unsigned char *cmd = pending[nPending++].cmd;
+      cmd[0] = CMD_HOWLER_ID;
+      cmd[1] = CMD_SET_RGB_LED_DEFAULT;
+      cmd[2] = i;
+      cmd[3] = (frame[i].red * level + 127) / 255;
+      cmd[4] = (frame[i].green * level + 127) / 255;
+      cmd[5] = (frame[i].blue * level + 127) / 255;
+    }
+  }
+
+  if(what & HOWLER_DEFAULTS_INPUTS) {
+    // Mappings that are not known yet are read synchronously up front, before
+    // anything is queued.
+    int ipt = eHowlerInput_FIRST;
+    for(; ipt <= eHowlerInput_LAST; ipt++) {
+      howler_input_mapping mapping;
+      int err = howler_get_input_mapping(&mapping, dev, (howler_input)ipt);
+      if(err < 0) {
+        return err;
+      }
+
+      unsigned char *cmd = pending[nPending++].cmd;
+      cmd[0] = CMD_HOWLER_ID;
+      cmd[1] = CMD_SET_DEFAULT;
+      cmd[2] = ipt;
+      cmd[3] = mapping.type;
+      cmd[4] = mapping.value1;
+      cmd[5] = mapping.value2;
+    }
+  }
+
+  int err = HOWLER_SUCCESS;
+  size_t i = 0;
+  for(; i < nPending && err == HOWLER_SUCCESS; i++) {
+    pending[i].state = &state;
+    err = queue_default(dev, &(pending[i]));
+  }
+
+  // The callbacks point into this stack frame, so everything that was queued
+  // has to finish before returning, even after an error. When the flush
+  // fails, what is left is cancelled, which still runs the callbacks.
+  int flush_err = howler_flush_commands(dev);
+  if(flush_err < 0) {
+    howler_cancel_commands(dev);
+  }
+
+  if(err < 0) {
+    return err;
+  }
+
+  if(flush_err < 0 || state.errors) {
+    return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+  }
+
+  if(state.mismatches) {
+    fprintf(stderr, "ERROR: %d of %lu defaults were not stored as sent\n",
+            state.mismatches, (unsigned long)nPending);
+    return HOWLER_ERROR_VERIFY_FAILED;
+  }
+
+  return HOWLER_SUCCESS;
+}
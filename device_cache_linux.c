@@ -0,0 +1,197 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char kCacheHeader[] = "# howler device cache v2";
+
+static int cache_path(char *dst, size_t dst_size) {
+  const char *path = getenv("HOWLER_DEVICE_CACHE");
+  if(path) {
+    if(!path[0]) {
+      return 0;
+    }
+    snprintf(dst, dst_size, "%s", path);
+    return 1;
+  }
+
+  const char *dir = getenv("XDG_CACHE_HOME");
+  if(dir && dir[0]) {
+    snprintf(dst, dst_size, "%s/howler-devices", dir);
+    return 1;
+  }
+
+  dir = getenv("HOME");
+  if(dir && dir[0]) {
+    snprintf(dst, dst_size, "%s/.cache/howler-devices", dir);
+    return 1;
+  }
+
+  return 0;
+}
+
+void howler_invalidate_device_cache(void) {
+  char path[PATH_MAX];
+  if(cache_path(path, sizeof(path))) {
+    unlink(path);
+  }
+}
+
+int howler_device_cache_load(howler_device_info *entries, int max_entries) {
+  char path[PATH_MAX];
+  if(!cache_path(path, sizeof(path))) {
+    return 0;
+  }
+
+  FILE *fp = fopen(path, "r");
+  if(!fp) {
+    return 0;
+  }
+
+  char line[128];
+  int n = 0;
+  if(!fgets(line, sizeof(line), fp) ||
+     strncmp(line, kCacheHeader, sizeof(kCacheHeader) - 1) != 0) {
+    goto done;
+  }
+
+  while(n < max_entries && fgets(line, sizeof(line), fp)) {
+    howler_device_info *entry = &(entries[n]);
+    memset(entry, 0, sizeof(*entry));
+
+    unsigned int product_id, capabilities, major, minor;
+    if(sscanf(line, "%31s %x %x %u %u %63s", entry->bus_path, &product_id,
+              &capabilities, &major, &minor, entry->serial) != 6 ||
+       major > 255 || minor > 255) {
+      // A damaged cache is no cache at all.
+      n = 0;
+      goto done;
+    }
+
+    entry->product_id = (unsigned short)product_id;
+    entry->capabilities = capabilities;
+    entry->firmware_major = (unsigned char)major;
+    entry->firmware_minor = (unsigned char)minor;
+    if(!(capabilities & HOWLER_CAPABILITY_SERIAL_NUMBER)) {
+      entry->serial[0] = '\0';
+    }
+    n++;
+  }
+
+ done:
+  fclose(fp);
+  return n;
+}
+
+void howler_device_cache_save(const howler_context *ctx) {
+  char path[PATH_MAX];
+  char tmp_path[PATH_MAX + 16];
+  if(!cache_path(path, sizeof(path))) {
+    return;
+  }
+
+  // Write a new file and rename it over the old one so that concurrent
+  // readers never see half of it.
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long)getpid());
+  FILE *fp = fopen(tmp_path, "w");
+  if(!fp) {
+    return;
+  }
+
+  fprintf(fp, "%s\n", kCacheHeader);
+
+  unsigned int i = 0;
+  for(; i < ctx->nDevices && i < HOWLER_MAX_CACHED_DEVICES; i++) {
+    const howler_device_info *info = &(ctx->devices[i].info);
+    fprintf(fp, "%s %04x %x %u %u %s\n", info->bus_path, info->product_id,
+            info->capabilities, info->firmware_major, info->firmware_minor,
+            info->serial[0]? info->serial : "-");
+  }
+
+  if(fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+    unlink(tmp_path);
+  }
+}
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000107)
+static int read_sysfs_number(const char *bus_path, const char *attr,
+                             unsigned int *value) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/%s", bus_path, attr);
+
+  FILE *fp = fopen(path, "r");
+  if(!fp) {
+    return 0;
+  }
+
+  int ok = (fscanf(fp, "%u", value) == 1);
+  fclose(fp);
+  return ok;
+}
+
+#endif
+
+int howler_open_bus_path(libusb_context *usb_ctx, const char *bus_path,
+                         libusb_device_handle **handle, int *fd) {
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000107)
+  unsigned int busnum, devnum;
+  if(!read_sysfs_number(bus_path, "busnum", &busnum) ||
+     !read_sysfs_number(bus_path, "devnum", &devnum)) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  char node[64];
+  snprintf(node, sizeof(node), "/dev/bus/usb/%03u/%03u", busnum, devnum);
+  *fd = open(node, O_RDWR | O_CLOEXEC);
+  if(*fd < 0) {
+    if(errno == EACCES) {
+      fprintf(stderr,
+              "WARNING: Unable to open interface to Howler device: "
+              "Permission Denied\n");
+    }
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  if(libusb_wrap_sys_device(usb_ctx, (intptr_t)(*fd), handle) < 0) {
+    close(*fd);
+    *fd = -1;
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  return HOWLER_SUCCESS;
+#else
+  // Opening by path needs libusb 1.0.23 or newer.
+  (void)usb_ctx;
+  (void)bus_path;
+  (void)handle;
+  *fd = -1;
+  return HOWLER_ERROR_INVALID_PARAMS;
+#endif
+}
@@ -0,0 +1,279 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Generates howler_led_map.h, which holds every table that relates LEDs to
+ * their locations in the six LED banks. The wiring below is the only place
+ * where the layout is written down: the inverse maps, membership masks and
+ * shuffles are all derived from it, and the build fails if it is not a
+ * one-to-one mapping of the 96 LED channels onto the 96 bank slots. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "howler.h"
+
+typedef unsigned char bank_location[2];
+
+static const bank_location kButtonWiring[HOWLER_NUM_BUTTONS][3] = {
+  /* Button 1 */
+  { /* Red */ { /* Bank 0 */ 0, /* Location 1 */ 1 },
+    /* Green */ { /* Bank 2 */ 2, /* Location 1 */ 1 },
+    /* Blue */ { /* Bank 4 */ 4, /* Location 1 */ 1 },
+  },
+
+  /* Button 2 */
+  { { 0, 2 }, { 2, 2 }, { 4, 2 } },
+
+  /* ... etc ... */
+  { { 0, 3 }, { 2, 3 }, { 4, 3 } },
+  { { 0, 4 }, { 2, 4 }, { 4, 4 } },
+  { { 0, 5 }, { 2, 5 }, { 4, 5 } },
+  { { 0, 6 }, { 2, 6 }, { 4, 6 } },
+  { { 0, 7 }, { 2, 7 }, { 4, 7 } },
+  { { 1, 0 }, { 3, 0 }, { 5, 0 } },
+  { { 1, 1 }, { 3, 1 }, { 5, 1 } },
+  { { 1, 2 }, { 3, 2 }, { 5, 2 } },
+  { { 1, 3 }, { 3, 3 }, { 5, 3 } },
+  { { 1, 4 }, { 3, 4 }, { 5, 4 } },
+  { { 1, 5 }, { 3, 5 }, { 5, 5 } },
+  { { 0, 14 }, { 2, 14 }, { 4, 14 } },
+  { { 0, 13 }, { 2, 13 }, { 4, 13 } },
+  { { 0, 12 }, { 2, 12 }, { 4, 12 } },
+  { { 0, 11 }, { 2, 11 }, { 4, 11 } },
+  { { 0, 10 }, { 2, 10 }, { 4, 10 } },
+  { { 0, 9 }, { 2, 9 }, { 4, 9 } },
+  { { 0, 8 }, { 2, 8 }, { 4, 8 } },
+  { { 1, 15 }, { 3, 15 }, { 5, 15 } },
+  { { 1, 14 }, { 3, 14 }, { 5, 14 } },
+  { { 1, 13 }, { 3, 13 }, { 5, 13 } },
+  { { 1, 12 }, { 3, 12 }, { 5, 12 } },
+  { { 1, 11 }, { 3, 11 }, { 5, 11 } },
+  { { 1, 10 }, { 3, 10 }, { 5, 10 } },
+};
+
+static const bank_location kJoystickWiring[HOWLER_NUM_JOYSTICKS][3] = {
+  { { 0, 0 }, { 2, 0 }, { 4, 0 } },
+  { { 0, 15 }, { 2, 15 }, { 4, 15 } },
+  { { 1, 6 }, { 3, 6 }, { 5, 6 } },
+  { { 1, 9 }, { 3, 9 }, { 5, 9 } },
+};
+
+static const bank_location kHighPowerWiring[HOWLER_NUM_HIGH_POWER_LEDS][3] = {
+  { { 1, 7 }, { 3, 7 }, { 5, 7 } },
+  { { 1, 8 }, { 3, 8 }, { 5, 8 } },
+};
+
+#define NUM_SLOTS (6 * 16)
+
+// Derived tables
+static bank_location gLedToBank[HOWLER_NUM_LEDS][3];
+static unsigned char gBankToControl[6][16][3];
+static unsigned char gFrameToBanks[NUM_SLOTS];
+static unsigned char gBanksToFrame[NUM_SLOTS];
+static unsigned int gBankLedMask[6];
+static unsigned char gLedBankMask[HOWLER_NUM_LEDS];
+static int gSlotUsed[NUM_SLOTS];
+
+static int add_control(const bank_location wiring[][3], int num_controls,
+                       int control_type, int first_led, const char *name) {
+  int i = 0;
+  for(; i < num_controls; i++) {
+    int led = first_led + i;
+    int k = 0;
+    for(; k < 3; k++) {
+      unsigned char bank = wiring[i][k][0];
+      unsigned char slot = wiring[i][k][1];
+      if(bank >= 6 || slot >= 16) {
+        fprintf(stderr, "%s %d: location (%d, %d) out of range\n",
+                name, i + 1, bank, slot);
+        return -1;
+      }
+
+      // The color correction picks its curve by bank.
+      if(bank / 2 != k) {
+        fprintf(stderr, "%s %d: channel %d wired to bank %d\n",
+                name, i + 1, k, bank);
+        return -1;
+      }
+
+      int flat = 16 * bank + slot;
+      if(gSlotUsed[flat]) {
+        fprintf(stderr, "%s %d: location (%d, %d) is already in use\n",
+                name, i + 1, bank, slot);
+        return -1;
+      }
+      gSlotUsed[flat] = 1;
+
+      gLedToBank[led][k][0] = bank;
+      gLedToBank[led][k][1] = slot;
+
+      gBankToControl[bank][slot][0] = control_type;
+      gBankToControl[bank][slot][1] = i + 1;
+      gBankToControl[bank][slot][2] = k;
+
+      gFrameToBanks[flat] = 3 * led + k;
+      gBanksToFrame[3 * led + k] = flat;
+
+      gBankLedMask[bank] |= 1U << led;
+      gLedBankMask[led] |= 1 << bank;
+    }
+  }
+  return 0;
+}
+
+static void write_locations(FILE *f, const char *name,
+                            const bank_location table[][3], int n) {
+  fprintf(f, "#define %s { \\\n", name);
+  int i = 0;
+  for(; i < n; i++) {
+    fprintf(f, "  { { %d, %d }, { %d, %d }, { %d, %d } }, \\\n",
+            table[i][0][0], table[i][0][1],
+            table[i][1][0], table[i][1][1],
+            table[i][2][0], table[i][2][1]);
+  }
+  fprintf(f, "}\n\n");
+}
+
+static void write_bytes(FILE *f, const char *name, const unsigned char *bytes,
+                        int n) {
+  fprintf(f, "#define %s { \\\n", name);
+  int i = 0;
+  for(; i < n; i++) {
+    fprintf(f, "%s%d,%s", (i % 16 == 0)? "  " : " ", bytes[i],
+            (i % 16 == 15 || i == n - 1)? " \\\n" : "");
+  }
+  fprintf(f, "}\n\n");
+}
+
+static void write_controls(FILE *f, const char *name) {
+  fprintf(f, "#define %s { \\\n", name);
+  int bank = 0;
+  for(; bank < 6; bank++) {
+    fprintf(f, "  {");
+    int slot = 0;
+    for(; slot < 16; slot++) {
+      fprintf(f, "%s{ %d, %d, %d }", (slot % 4 == 0)? " \\\n    " : " ",
+              gBankToControl[bank][slot][0],
+              gBankToControl[bank][slot][1],
+              gBankToControl[bank][slot][2]);
+      fprintf(f, ",");
+    }
+    fprintf(f, " \\\n  }, \\\n");
+  }
+  fprintf(f, "}\n\n");
+}
+
+/* The pshufb controls that move the bytes of each 16 byte input register to
+ * each 16 byte output register. Lanes that come from elsewhere have their
+ * high bit set so that the shuffle leaves them zero. */
+static void write_shuffles(FILE *f, const char *name, const unsigned char *perm) {
+  fprintf(f, "#define %s { \\\n", name);
+  int k = 0;
+  for(; k < 6; k++) {
+    fprintf(f, "  { \\\n");
+    int c = 0;
+    for(; c < 6; c++) {
+      fprintf(f, "    {");
+      int i = 0;
+      for(; i < 16; i++) {
+        unsigned char src = perm[16 * k + i];
+        fprintf(f, " %d,", (src / 16 == c)? (src % 16) : 0x80);
+      }
+      fprintf(f, " }, \\\n");
+    }
+    fprintf(f, "  }, \\\n");
+  }
+  fprintf(f, "}\n\n");
+}
+
+int main(int argc, char **argv) {
+  if(argc != 2) {
+    fprintf(stderr, "Usage: %s OUTPUT_HEADER\n", argv[0]);
+    return 1;
+  }
+
+  memset(gSlotUsed, 0, sizeof(gSlotUsed));
+
+  int err = 0;
+  err = err || add_control(kJoystickWiring, HOWLER_NUM_JOYSTICKS,
+                           HOWLER_CONTROL_JOYSTICK,
+                           HOWLER_LED_INDEX_JOYSTICK(1), "Joystick");
+  err = err || add_control(kButtonWiring, HOWLER_NUM_BUTTONS,
+                           HOWLER_CONTROL_BUTTON,
+                           HOWLER_LED_INDEX_BUTTON(1), "Button");
+  err = err || add_control(kHighPowerWiring, HOWLER_NUM_HIGH_POWER_LEDS,
+                           HOWLER_CONTROL_HIGH_POWER,
+                           HOWLER_LED_INDEX_HIGH_POWER(1), "High power LED");
+  if(err) {
+    return 1;
+  }
+
+  int i = 0;
+  for(; i < NUM_SLOTS; i++) {
+    if(!gSlotUsed[i]) {
+      fprintf(stderr, "Bank %d location %d is not wired to any LED\n",
+              i / 16, i % 16);
+      return 1;
+    }
+  }
+
+  FILE *f = fopen(argv[1], "w");
+  if(!f) {
+    fprintf(stderr, "Unable to open %s for writing\n", argv[1]);
+    return 1;
+  }
+
+  fprintf(f, "/* Generated by howler-gen-tables from gen_led_tables.c. "
+             "Do not edit. */\n\n");
+  fprintf(f, "#ifndef __HOWLER_LED_MAP_H__\n#define __HOWLER_LED_MAP_H__\n\n");
+
+  write_locations(f, "HOWLER_BUTTON_TO_BANK_INIT", kButtonWiring,
+                  HOWLER_NUM_BUTTONS);
+  write_locations(f, "HOWLER_JOYSTICK_TO_BANK_INIT", kJoystickWiring,
+                  HOWLER_NUM_JOYSTICKS);
+  write_locations(f, "HOWLER_HP_LED_TO_BANK_INIT", kHighPowerWiring,
+                  HOWLER_NUM_HIGH_POWER_LEDS);
+  write_locations(f, "HOWLER_LED_TO_BANK_INIT",
+                  (const bank_location (*)[3])gLedToBank, HOWLER_NUM_LEDS);
+
+  write_controls(f, "HOWLER_BANK_TO_CONTROL_INIT");
+  write_bytes(f, "HOWLER_FRAME_TO_BANKS_INIT", gFrameToBanks, NUM_SLOTS);
+  write_bytes(f, "HOWLER_BANKS_TO_FRAME_INIT", gBanksToFrame, NUM_SLOTS);
+  write_shuffles(f, "HOWLER_FRAME_TO_BANKS_SHUFFLE_INIT", gFrameToBanks);
+  write_shuffles(f, "HOWLER_BANKS_TO_FRAME_SHUFFLE_INIT", gBanksToFrame);
+  write_bytes(f, "HOWLER_LED_BANK_MASK_INIT", gLedBankMask, HOWLER_NUM_LEDS);
+
+  fprintf(f, "#define HOWLER_BANK_LED_MASK_INIT {");
+  for(i = 0; i < 6; i++) {
+    fprintf(f, " 0x%08xU,", gBankLedMask[i]);
+  }
+  fprintf(f, " }\n\n");
+
+  fprintf(f, "#endif  // __HOWLER_LED_MAP_H__\n");
+
+  if(fclose(f) != 0) {
+    fprintf(stderr, "Unable to write %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,80 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <string.h>
+
+void howler_latency_histogram_reset(howler_latency_histogram *hist) {
+  memset(hist, 0, sizeof(*hist));
+}
+
+void howler_latency_histogram_add(howler_latency_histogram *hist,
+                                  uint64_t ns) {
+  int bucket = 0;
+  if(ns > 1) {
+    bucket = 63 - __builtin_clzll(ns);
+  }
+
+  if(bucket >= HOWLER_LATENCY_BUCKETS) {
+    bucket = HOWLER_LATENCY_BUCKETS - 1;
+  }
+
+  if(!hist->count || ns < hist->min_ns) {
+    hist->min_ns = ns;
+  }
+
+  if(ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+
+  hist->count++;
+  hist->total_ns += ns;
+  hist->buckets[bucket]++;
+}
+
+uint64_t howler_latency_histogram_percentile(
+  const howler_latency_histogram *hist, double percentile) {
+  if(!hist->count) {
+    return 0;
+  }
+
+  unsigned long long target =
+    (unsigned long long)((percentile / 100.0) * (double)hist->count);
+  if(target >= hist->count) {
+    target = hist->count - 1;
+  }
+
+  unsigned long long seen = 0;
+  int i = 0;
+  for(; i < HOWLER_LATENCY_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if(seen > target) {
+      break;
+    }
+  }
+
+  // The upper edge of the bucket, but never more than the largest sample.
+  uint64_t bound = (i + 1 < 64)? (1ULL << (i + 1)) : hist->max_ns;
+  return (bound < hist->max_ns)? bound : hist->max_ns;
+}
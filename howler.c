@@ -37,6 +37,8 @@
 
 typedef unsigned char bank_location[2];
 
+typedef char inputs_match_enum[(HOWLER_NUM_INPUTS == eHowlerInput_LAST + 1)? 1 : -1];
+
 static const unsigned char IT_KEYBOARD = 0x03;
 
 /*******************************************************************************
@@ -108,7 +110,10 @@ static int howler_set_led_bank(howler_device *dev, unsigned char index,
   assert((sizeof(cmd_buf) - 3) > sizeof(*bank));
   memcpy(cmd_buf + 3, bank, sizeof(*bank));
 
-  return howler_sendrcv(dev, cmd_buf, NULL);
+  HOWLER_SPAN_BEGIN(span);
+  int err = howler_sendrcv(dev, cmd_buf, NULL);
+  HOWLER_SPAN_END(span, "bank_write", index - 1);
+  return err;
 }
 
 /* Gets the LED values for a given index */
@@ -145,15 +150,185 @@ static int howler_get_led(howler_led *out,
 }
 
 /* Sets the LED banks for the given device */
-static int update_led_bank(howler_device *dev, bank_location loc, unsigned char value) {
+static int update_led_bank(howler_device *dev, const bank_location loc, unsigned char value) {
   unsigned char bank = loc[0];
   unsigned char led = loc[1];
-  if(dev->led_banks[bank][led] == value) {
+  dev->logical_banks[bank][led] = value;
+
+  // In the middle of a fade every bank is shown dimmed, so they all need to
+  // be brought up to date together.
+  if(dev->brightness.fade != 255) {
+    return howler_refresh_led_banks(dev);
+  }
+
+  value = howler_led_transform_channel(&(dev->led_transform), bank, led, value);
+  if(dev->led_banks[bank][led] == value && !(dev->failed_banks & (1 << bank))) {
     return 0;
   }
 
   dev->led_banks[bank][led] = value;
-  return howler_set_led_bank(dev, bank + 1, &(dev->led_banks[bank]));
+  return howler_send_led_banks(dev, 1 << bank);
+}
+
+int howler_send_led_banks(howler_device *dev, unsigned int dirty_mask) {
+  int err = 0;
+  while(dirty_mask) {
+    unsigned char bank = __builtin_ctz(dirty_mask);
+    dirty_mask &= dirty_mask - 1;
+
+    if(howler_set_led_bank(dev, bank + 1, &(dev->led_banks[bank])) < 0) {
+      dev->failed_banks |= 1 << bank;
+      err = -1;
+    } else {
+      dev->failed_banks &= ~(1 << bank);
+    }
+  }
+
+  return err;
+}
+
+/* Returns the fade level that shows hw on the device without writing any
+ * banks, or -1 if the banks have to be written. Full brightness is left to
+ * the bank writes, which then also catch changes within a step of rounding. */
+static int fade_level(const howler_device *dev, const howler_led_bank *hw) {
+  int level = howler_led_banks_uniform_scale(hw, (const howler_led_bank *)dev->led_banks);
+  return (level < 255)? level : -1;
+}
+
+static howler_led_channel device_brightness(const howler_brightness *b) {
+  return (howler_led_channel)((b->level * b->fade + 127) / 255);
+}
+
+static void brightness_cmd(unsigned char *cmd_buf, howler_led_channel level) {
+  memset(cmd_buf, 0, HOWLER_COMMAND_SIZE);
+  cmd_buf[0] = CMD_HOWLER_ID;
+  cmd_buf[1] = CMD_SET_GLOBAL_BRIGHTNESS;
+  cmd_buf[2] = level;
+}
+
+static int sync_brightness(howler_device *dev) {
+  howler_led_channel level = device_brightness(&(dev->brightness));
+  if(level == dev->brightness.sent) {
+    return 0;
+  }
+
+  unsigned char cmd_buf[HOWLER_COMMAND_SIZE];
+  brightness_cmd(cmd_buf, level);
+  int err = howler_sendrcv(dev, cmd_buf, NULL);
+  if(err >= 0) {
+    dev->brightness.sent = level;
+  }
+  return err;
+}
+
+void howler_brightness_init(howler_brightness *brightness) {
+  brightness->level = 255;
+  brightness->fade = 255;
+  brightness->sent = 255;
+}
+
+int howler_refresh_led_banks(howler_device *dev) {
+  HOWLER_SPAN_BEGIN(span);
+  howler_led_bank hw[6];
+  howler_led_transform_apply(&(dev->led_transform), hw,
+                             (const howler_led_bank *)dev->logical_banks);
+
+  // A fade only dims what the device already shows, so it cannot be used
+  // while some banks failed to go out.
+  int err = 0;
+  unsigned int dirty = 0;
+  int fade = dev->failed_banks? -1 : fade_level(dev, hw);
+  if(fade >= 0) {
+    dev->brightness.fade = fade;
+    err = sync_brightness(dev);
+  } else {
+    // The banks go out before the brightness is restored, so nothing flashes
+    // at the old colors.
+    dirty = howler_led_banks_diff(hw, (const howler_led_bank *)dev->led_banks);
+    dirty |= dev->failed_banks;
+    memcpy(dev->led_banks, hw, sizeof(hw));
+    err = howler_send_led_banks(dev, dirty);
+
+    dev->brightness.fade = 255;
+    if(sync_brightness(dev) < 0) {
+      err = -1;
+    }
+  }
+
+  HOWLER_SPAN_END(span, "refresh_led_banks", (int)dirty);
+  return err;
+}
+
+int howler_refresh_led_banks_async(howler_device *dev,
+                                   howler_command_callback callback,
+                                   void *user_data) {
+  howler_led_bank hw[6];
+  howler_led_transform_apply(&(dev->led_transform), hw,
+                             (const howler_led_bank *)dev->logical_banks);
+
+  int fade = dev->failed_banks? -1 : fade_level(dev, hw);
+  unsigned int dirty = 0;
+  if(fade < 0) {
+    dirty = howler_led_banks_diff(hw, (const howler_led_bank *)dev->led_banks);
+    dirty |= dev->failed_banks;
+  }
+
+  howler_brightness next = dev->brightness;
+  next.fade = (fade >= 0)? fade : 255;
+  howler_led_channel level = device_brightness(&next);
+  int send_level = (level != dev->brightness.sent);
+
+  // The brightness shares the LED queue so that it lands after the banks.
+  size_t nCommands = __builtin_popcount(dirty) + send_level;
+  if(howler_command_queue_space(dev, HOWLER_PRIORITY_LED) < nCommands) {
+    return HOWLER_ERROR_QUEUE_FULL;
+  }
+
+  // The queued writes are marked as failed again when they complete with an
+  // error, see complete_command.
+  if(fade < 0) {
+    memcpy(dev->led_banks, hw, sizeof(hw));
+    dev->failed_banks &= ~dirty;
+  }
+  dev->brightness.fade = next.fade;
+
+  int queued = 0;
+  while(dirty) {
+    unsigned char bank = __builtin_ctz(dirty);
+    dirty &= dirty - 1;
+
+    unsigned char cmd_buf[HOWLER_COMMAND_SIZE];
+    memset(cmd_buf, 0, sizeof(cmd_buf));
+    cmd_buf[0] = CMD_HOWLER_ID;
+    cmd_buf[1] = CMD_SET_RGB_LED_BANK;
+    cmd_buf[2] = bank + 1;
+    memcpy(cmd_buf + 3, dev->led_banks[bank], sizeof(howler_led_bank));
+
+    int last = (dirty == 0 && !send_level);
+    int err = howler_submit_command(dev, cmd_buf, 0,
+                                    last? callback : NULL,
+                                    last? user_data : NULL);
+    if(err < 0) {
+      dev->failed_banks |= dirty | (1 << bank);
+      return err;
+    }
+    queued++;
+  }
+
+  if(send_level) {
+    unsigned char cmd_buf[HOWLER_COMMAND_SIZE];
+    brightness_cmd(cmd_buf, level);
+    int err = howler_submit_command_with_priority(dev, HOWLER_PRIORITY_LED,
+                                                  cmd_buf, 0, callback,
+                                                  user_data);
+    if(err < 0) {
+      return err;
+    }
+    dev->brightness.sent = level;
+    queued++;
+  }
+
+  return queued;
 }
 
 /*******************************************************************************
@@ -172,44 +347,70 @@ howler_device *howler_get_device(howler_context *ctx, unsigned int device_index)
   return ctx->devices + device_index;
 }
 
+const howler_device_info *howler_get_device_info(const howler_device *dev) {
+  return dev? &(dev->info) : NULL;
+}
+
+void howler_get_transfer_stats(const howler_device *dev,
+                               howler_transfer_stats *stats) {
+  if(!dev || !stats) { return; }
+  *stats = dev->transfer_stats;
+}
+
 int howler_get_device_version(howler_device *dev, char *dst,
                               size_t dst_size, size_t *dst_len) {
-  // Setup the commands
-  unsigned char cmd_buf[24];
-  memset(cmd_buf, 0, sizeof(cmd_buf));
+  if(!dev || !dst || !dst_size) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
 
-  unsigned char output[24];
-  memset(output, 0, sizeof(output));
+  // The version is normally read once when the device is opened.
+  if(!(dev->info.capabilities & HOWLER_CAPABILITY_FIRMWARE_VERSION)) {
+    unsigned char cmd_buf[24];
+    memset(cmd_buf, 0, sizeof(cmd_buf));
 
-  cmd_buf[0] = CMD_HOWLER_ID;
-  cmd_buf[1] = CMD_GET_FW_REV;
+    unsigned char output[24];
+    memset(output, 0, sizeof(output));
 
-  int err = howler_sendrcv(dev, cmd_buf, output);
-  if(err < 0 || output[0] != CMD_HOWLER_ID || output[1] != CMD_GET_FW_REV) {
-    return 0;
-  }
+    cmd_buf[0] = CMD_HOWLER_ID;
+    cmd_buf[1] = CMD_GET_FW_REV;
+
+    int err = howler_sendrcv(dev, cmd_buf, output);
+    if(err < 0 || output[0] != CMD_HOWLER_ID || output[1] != CMD_GET_FW_REV) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
 
+    dev->info.firmware_major = output[2];
+    dev->info.firmware_minor = output[3];
+    dev->info.capabilities |= HOWLER_CAPABILITY_FIRMWARE_VERSION;
+  }
 
-  float version = (float)(output[2]) + 0.001 * (float)(output[3]);
-  snprintf(dst, dst_size, "%.3f", version);
+  // Same as formatting major + 0.001 * minor with three decimals.
+  snprintf(dst, dst_size, "%u.%03u", dev->info.firmware_major,
+           dev->info.firmware_minor);
   dst[dst_size - 1] = '\0';
 
   if(dst_len) {
     *dst_len = strlen(dst) + 1;
   }
 
-  return err;
+  return HOWLER_SUCCESS;
 }
 
 int howler_set_global_brightness(howler_device *dev, howler_led_channel level) {
-  unsigned char cmd_buf[24];
-  memset(cmd_buf, 0, sizeof(cmd_buf));
+  if(!dev) { return HOWLER_ERROR_INVALID_PTR; }
 
-  cmd_buf[0] = CMD_HOWLER_ID;
-  cmd_buf[1] = CMD_SET_GLOBAL_BRIGHTNESS;
-  cmd_buf[2] = level;
+  dev->brightness.level = level;
+  howler_led_channel device_level = device_brightness(&(dev->brightness));
 
-  return howler_sendrcv(dev, cmd_buf, NULL);
+  unsigned char cmd_buf[24];
+  brightness_cmd(cmd_buf, device_level);
+
+  // A level that did not reach the device is sent again by the next refresh.
+  int err = howler_sendrcv(dev, cmd_buf, NULL);
+  if(err >= 0) {
+    dev->brightness.sent = device_level;
+  }
+  return err;
 }
 
 /* Sets the RGB LED value of the given button
@@ -374,5 +575,50 @@ int howler_set_input_keyboard(howler_device *dev, howler_input ipt,
     err = -1;
   }
 
+  if(err == 0) {
+    dev->input_map[ipt].type = IT_KEYBOARD;
+    dev->input_map[ipt].value1 = code;
+    dev->input_map[ipt].value2 = modifiers & 0xFF;
+    dev->input_map_known |= ((howler_input_mask)1) << ipt;
+  }
+
   return err;
 }
+
+int howler_get_input_mapping(howler_input_mapping *out, howler_device *dev,
+                             howler_input ipt) {
+  if(!out || !dev) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  if(ipt < eHowlerInput_FIRST || ipt > eHowlerInput_LAST) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  howler_input_mask bit = ((howler_input_mask)1) << ipt;
+  if(!(dev->input_map_known & bit)) {
+    unsigned char cmd_buf[24];
+    memset(cmd_buf, 0, sizeof(cmd_buf));
+
+    unsigned char output[24];
+    memset(output, 0, sizeof(output));
+
+    cmd_buf[0] = CMD_HOWLER_ID;
+    cmd_buf[1] = CMD_GET_INPUT;
+    cmd_buf[2] = ipt;
+
+    if(howler_sendrcv(dev, cmd_buf, output) < 0 ||
+       output[0] != CMD_HOWLER_ID || output[1] != CMD_GET_INPUT ||
+       output[2] != ipt) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+
+    dev->input_map[ipt].type = output[3];
+    dev->input_map[ipt].value1 = output[4];
+    dev->input_map[ipt].value2 = output[5];
+    dev->input_map_known |= bit;
+  }
+
+  *out = dev->input_map[ipt];
+  return HOWLER_SUCCESS;
+}
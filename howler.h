@@ -24,6 +24,8 @@
 #ifndef __HOWLER_LIB_H__
 #define __HOWLER_LIB_H__
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <libusb.h>
 
@@ -56,6 +58,9 @@ extern "C" {
 #define HOWLER_NUM_LEDS \
   (HOWLER_NUM_BUTTONS + HOWLER_NUM_JOYSTICKS + HOWLER_NUM_HIGH_POWER_LEDS)
 
+/* Joystick directions, buttons and accelerometer axes; see howler_input. */
+#define HOWLER_NUM_INPUTS 45
+
 typedef unsigned char howler_led_channel;
 typedef union {
   struct {
@@ -72,34 +77,408 @@ typedef enum {
   HOWLER_LED_CHANNEL_BLUE
 } howler_led_channel_name;
 
+/* Each bit in a howler_input_mask corresponds to the howler_input of the same
+ * value, e.g. bit 0x10 is set while Button 1 is held down. */
+typedef uint64_t howler_input_mask;
+
+struct howler_context;
+
+typedef enum {
+  // Every change in the input report is an edge.
+  HOWLER_DEBOUNCE_NONE = 0,
+
+  // An edge is reported as soon as it is seen, after which the input ignores
+  // further changes for a hold-off period given in milliseconds.
+  HOWLER_DEBOUNCE_TIME,
+
+  // An edge is reported once the input has held its new state for a given
+  // number of consecutive samples (1-7). The input is sampled on every report
+  // and every millisecond while a change is pending.
+  HOWLER_DEBOUNCE_INTEGRATOR
+} howler_debounce_mode;
+
+/* Debouncing state for all of the inputs of a device. Each input is
+ * represented by its bit in the masks, so that all of them are updated
+ * together with a handful of bitwise operations per report. */
+typedef struct {
+  howler_input_mask time_mask;
+  howler_input_mask integrator_mask;
+
+  // Inputs that are inside of their hold-off period, and when it ends.
+  howler_input_mask locked;
+  uint64_t hold_off_ns[64];
+  uint64_t unlock_ns[64];
+  uint64_t next_unlock_ns;
+
+  // Bit planes of the per-input sample thresholds and of the vertical
+  // counters that count the samples seen since a change.
+  howler_input_mask threshold[3];
+  howler_input_mask count[3];
+  uint64_t next_sample_ns;
+} howler_debounce_state;
+
 typedef howler_led_channel howler_led_bank[16];
+
+/* Color correction applied to every LED value on its way to the hardware.
+ * Banks 0-1 hold the red channels, 2-3 the green channels and 4-5 the blue
+ * channels, so the curve for each value is selected by its bank. */
+typedef struct {
+  int identity;
+
+  // Gamma and white balance combined, for each color channel.
+  howler_led_channel curve[3][256];
+  float gamma;
+  howler_led white_balance;
+
+  // Maximum output of each channel, laid out like the LED banks.
+  howler_led_bank max_level[6];
+} howler_led_transform;
+
+/* Commands waiting to be sent asynchronously to a device. Commands are sent
+ * one at a time, each one followed by a read of its response when it expects
+ * one. Every priority class has its own queue of HOWLER_COMMAND_QUEUE_DEPTH
+ * commands that are sent in submission order. The depth can be changed at
+ * build time by defining HOWLER_COMMAND_QUEUE_DEPTH. */
+#define HOWLER_COMMAND_SIZE 24
+#ifndef HOWLER_COMMAND_QUEUE_DEPTH
+#define HOWLER_COMMAND_QUEUE_DEPTH 64
+#endif
+
+typedef enum {
+  HOWLER_PRIORITY_CONTROL = 0,
+  HOWLER_PRIORITY_INPUT,
+  HOWLER_PRIORITY_LED,
+  HOWLER_PRIORITY_READBACK,
+
+  HOWLER_NUM_COMMAND_PRIORITIES
+} howler_command_priority;
+
+struct howler_device;
+typedef void (*howler_command_callback)(struct howler_device *dev,
+                                        int status,
+                                        const unsigned char *response,
+                                        void *user_data);
+
+typedef struct {
+  unsigned char cmd[HOWLER_COMMAND_SIZE];
+  int expects_response;
+  howler_command_callback callback;
+  void *user_data;
+  uint64_t sequence;
+} howler_command;
+
+typedef struct {
+  howler_command entries[HOWLER_COMMAND_QUEUE_DEPTH];
+  unsigned int head;
+  unsigned int count;
+
+  // Number of commands from other classes sent while this one was waiting.
+  unsigned int bypassed;
+} howler_command_ring;
+
+typedef struct {
+  howler_command_ring rings[HOWLER_NUM_COMMAND_PRIORITIES];
+  uint64_t next_sequence;
+
+  // Commands submitted and not yet completed, including the current one.
+  unsigned int count;
+  howler_command current;
+
+  // Transfers for the command currently on the wire.
+  void *out_transfer;
+  void *in_transfer;
+  unsigned char response[HOWLER_COMMAND_SIZE];
+  uint64_t command_start_ns;
+  int in_flight;
+  int cancelling;
+
+  int interface_claimed;
+  int kernel_driver_attached;
+} howler_command_queue;
+
+/* Pacing of frames committed with howler_commit_led_frame. At most one frame
+ * is on the wire at a time; frames committed meanwhile are merged into the
+ * next one, which is sent as soon as the previous frame completes. */
+typedef struct {
+  int pending;
+  int in_flight;
+  uint64_t send_start_ns;
+  uint64_t next_send_ns;
+  uint64_t min_interval_ns;
+
+  // Smoothed time for the bank writes of one frame to complete.
+  uint64_t rtt_ewma_ns;
+  uint64_t rtt_min_ns;
+  uint64_t rtt_max_ns;
+
+  unsigned long long committed;
+  unsigned long long sent;
+  unsigned long long dropped;
+  unsigned long long unchanged;
+  unsigned long long identical;
+  unsigned long long banks_avoided;
+  unsigned long long errors;
+  unsigned long long fades;
+
+  // Commits in a row that repeated the previous frame.
+  unsigned int static_commits;
+} howler_frame_pacer;
+
+/* Log2 histogram of latencies. Bucket i counts the samples that took between
+ * 2^i and 2^(i+1) nanoseconds, and the last bucket counts everything longer.
+ */
+#define HOWLER_LATENCY_BUCKETS 32
+typedef struct {
+  unsigned long long count;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t total_ns;
+  unsigned long long buckets[HOWLER_LATENCY_BUCKETS];
+} howler_latency_histogram;
+
+/* Traffic with a device: the interrupt transfers sent and received, both
+ * synchronous and queued, those that failed, the input reports that arrived,
+ * and the time from the start of each queued command to its completion. */
+typedef struct {
+  unsigned long long transfers;
+  unsigned long long failures;
+  unsigned long long input_reports;
+  howler_latency_histogram command_latency;
+} howler_transfer_stats;
+
+/* Global brightness of a device: the level set with
+ * howler_set_global_brightness, the level of a uniform fade that was sent in
+ * place of bank writes (255 when there is none), and the product of the two
+ * as last sent to the device. */
+typedef struct {
+  howler_led_channel level;
+  howler_led_channel fade;
+  howler_led_channel sent;
+} howler_brightness;
+
+/* What a device reported when it was opened. bus_path is its USB topology
+ * path in the sysfs form bus-port.port..., and serial is empty when the
+ * device has no serial number. */
+#define HOWLER_BUS_PATH_SIZE 32
+#define HOWLER_SERIAL_SIZE 64
+
+#define HOWLER_CAPABILITY_FIRMWARE_VERSION 0x1
+#define HOWLER_CAPABILITY_INPUT_ENDPOINT 0x2
+#define HOWLER_CAPABILITY_SERIAL_NUMBER 0x4
+
 typedef struct {
+  unsigned short product_id;
+  unsigned char firmware_major;
+  unsigned char firmware_minor;
+  unsigned int capabilities;
+  char bus_path[HOWLER_BUS_PATH_SIZE];
+  char serial[HOWLER_SERIAL_SIZE];
+} howler_device_info;
+
+/* How the firmware maps an input, as sent with CMD_SET_INPUT: the input type
+ * followed by two type specific values, e.g. the scan code and modifiers of
+ * a keyboard key. */
+typedef struct {
+  unsigned char type;
+  unsigned char value1;
+  unsigned char value2;
+} howler_input_mapping;
+
+typedef struct howler_device {
   void *usb_handle;
+
+  // sys_fd is the descriptor a cached device was opened through, or -1.
+  howler_device_info info;
+  int sys_fd;
+
+  // The values sent to the hardware, and the values requested by the
+  // application before color correction. During a fade the hardware shows
+  // led_banks scaled by the global brightness.
   howler_led_bank led_banks[6];
+  howler_led_bank logical_banks[6];
+
+  // Banks of led_banks whose last write did not reach the device. Every
+  // refresh sends them again, whether or not they changed since.
+  unsigned int failed_banks;
+
+  // Banks of logical_banks that were rewritten in place and not committed
+  // yet, see howler_commit_marked_banks.
+  unsigned int marked_banks;
+  howler_led_transform led_transform;
+  howler_brightness brightness;
+
+  struct howler_context *ctx;
+
+  // Input polling on HOWLER_INPUT_ENDPOINT. The transfer is allocated when
+  // the device is opened, and input_pending is set while it is submitted.
+  // input_received is set when it completed with a report that
+  // howler_handle_events has not dispatched yet, and input_arrival_ns is when.
+  void *input_transfer;
+  int input_pending;
+  int input_received;
+  uint64_t input_arrival_ns;
+  int input_kernel_driver_attached;
+  unsigned char input_report[24];
+  howler_input_mask input_state;
+  uint64_t input_sequence;
+
+  // The undebounced state from the last report, and when it arrived.
+  howler_input_mask input_raw;
+  uint64_t input_raw_arrival_ns;
+  howler_debounce_state debounce;
+
+  howler_command_queue commands;
+  howler_frame_pacer frame_pacer;
+  howler_transfer_stats transfer_stats;
+
+  // Input mappings set through the library or read back from the device,
+  // for the inputs whose bits are set in input_map_known.
+  howler_input_mapping input_map[HOWLER_NUM_INPUTS];
+  howler_input_mask input_map_known;
 } howler_device;
 
-extern unsigned char howler_button_to_bank[HOWLER_NUM_BUTTONS][3][2];
-extern unsigned char howler_joystick_to_bank[HOWLER_NUM_JOYSTICKS][3][2];
-extern unsigned char howler_hp_led_to_bank[HOWLER_NUM_HIGH_POWER_LEDS][3][2];
+typedef enum {
+  HOWLER_CONTROL_JOYSTICK = 0,
+  HOWLER_CONTROL_BUTTON,
+  HOWLER_CONTROL_HIGH_POWER
+} howler_control_type;
+
+/* The following tables are generated at build time from the wiring in
+ * gen_led_tables.c. Locations are given as { bank, slot }. */
+extern const unsigned char howler_button_to_bank[HOWLER_NUM_BUTTONS][3][2];
+extern const unsigned char howler_joystick_to_bank[HOWLER_NUM_JOYSTICKS][3][2];
+extern const unsigned char howler_hp_led_to_bank[HOWLER_NUM_HIGH_POWER_LEDS][3][2];
+
+/* The locations of each LED, indexed like a howler_led_frame */
+extern const unsigned char howler_led_to_bank[HOWLER_NUM_LEDS][3][2];
+
+/* The inverse map from { bank, slot } to { howler_control_type, control number
+ * (starting from 1), howler_led_channel_name }. */
+extern const unsigned char howler_bank_to_control[6][16][3];
+
+/* Byte i of the banks holds byte howler_frame_to_banks[i] of a
+ * howler_led_frame, and byte i of the frame holds byte
+ * howler_banks_to_frame[i] of the banks. */
+extern const unsigned char howler_frame_to_banks[6 * 16];
+extern const unsigned char howler_banks_to_frame[6 * 16];
+
+/* The banks that hold a channel of each LED, and the LEDs, by frame index,
+ * that have a channel in each bank. */
+extern const unsigned char howler_led_bank_mask[HOWLER_NUM_LEDS];
+extern const uint32_t howler_bank_led_mask[6];
 
 typedef void (*howler_button_callback)(int button, void *user_data);
 
+/* Called once for every input report that changes the state of the device.
+ * changed - The inputs whose state differs from the previous report
+ * state - The state of all inputs after this report
+ * arrival_ns - CLOCK_MONOTONIC time at which the report was received */
+typedef void (*howler_report_callback)(howler_device *dev,
+                                       howler_input_mask changed,
+                                       howler_input_mask state,
+                                       uint64_t arrival_ns,
+                                       void *user_data);
+
+/* A single input edge along with the time at which it was observed. */
 typedef struct {
+  howler_device *device;
+  int input;     // The corresponding howler_input
+  int pressed;   // 1 when the input went down, 0 when it was released
+
+  // Incremented for every event on the device, so gaps indicate lost events.
+  uint64_t sequence;
+
+  // CLOCK_MONOTONIC times, in nanoseconds, at which the report carrying this
+  // event arrived and at which the event was handed to the callbacks.
+  uint64_t arrival_ns;
+  uint64_t dispatch_ns;
+} howler_input_event;
+
+typedef void (*howler_input_event_callback)(const howler_input_event *event,
+                                            void *user_data);
+
+typedef struct howler_context {
   void *usb_ctx;
-  void *polling;
+  int owns_usb_ctx;
+  int external_events;
+
+  // File the spans are written to on howler_destroy, when howler_init
+  // started tracing for HOWLER_SPANS.
+  const char *span_trace_path;
   size_t nDevices;
   howler_device *devices;
 
   int exitFlag;
+  int input_started;
   howler_button_callback key_down_callback;
   howler_button_callback key_up_callback;
+  void *callback_user_data;
+
+  howler_report_callback report_callback;
+  void *report_user_data;
+
+  howler_input_event_callback input_event_callback;
+  void *input_event_user_data;
+
+  // Delay between the arrival of an input report and the dispatch of each of
+  // its events to the callbacks.
+  howler_latency_histogram input_latency;
+
+  // Open trace file while traffic is being recorded, and when it started.
+  void *trace_file;
+  uint64_t trace_start_ns;
+
+  // Timeline being played back by howler_handle_events, if any.
+  struct howler_timeline *timeline;
+
+  // Time taken by howler_init to open the devices.
+  uint64_t init_ns;
+
+  // Reaction rules run on input edges, and the inputs they watch.
+  struct howler_reaction *reactions;
+  size_t nReactions;
+  howler_input_mask reaction_inputs;
+
+  // Storage of the context and its devices in a static allocation build.
+  struct howler_arena *arena;
 } howler_context;
 
+/* Static allocation. A build with HOWLER_STATIC_ALLOCATION defined takes no
+ * memory from the heap for the context and its devices. They live in a
+ * howler_arena, either one passed in howler_init_options or the single one
+ * that the library reserves, and every libusb transfer a device needs is
+ * allocated when it is opened, so nothing is allocated after init returns.
+ * At most HOWLER_MAX_DEVICES devices are opened and any others are ignored.
+ *
+ * HOWLER_STATIC_ALLOCATION, HOWLER_MAX_DEVICES and HOWLER_COMMAND_QUEUE_DEPTH
+ * change the layout of the structs in this header, so applications must be
+ * compiled with the same definitions as the library. */
+#ifdef HOWLER_STATIC_ALLOCATION
+#ifndef HOWLER_MAX_DEVICES
+#define HOWLER_MAX_DEVICES 4
+#endif
+
+struct howler_arena {
+  howler_context context;
+  howler_device devices[HOWLER_MAX_DEVICES];
+  int in_use;
+};
+#endif
+typedef struct howler_arena howler_arena;
+
 static const int HOWLER_SUCCESS = 0;
 static const int HOWLER_ERROR_INVALID_PTR = -1;
 static const int HOWLER_ERROR_LIBUSB_CONTEXT_ERROR = -2;
 static const int HOWLER_ERROR_LIBUSB_DEVICE_LIST_ERROR = -3;
 static const int HOWLER_ERROR_INVALID_PARAMS = -4;
+static const int HOWLER_ERROR_LIBUSB_TRANSFER_ERROR = -5;
+static const int HOWLER_ERROR_UINPUT_ERROR = -6;
+static const int HOWLER_ERROR_QUEUE_FULL = -7;
+static const int HOWLER_ERROR_CANCELLED = -8;
+static const int HOWLER_ERROR_UNSUPPORTED = -9;
+static const int HOWLER_ERROR_VERIFY_FAILED = -10;
+static const int HOWLER_ERROR_OUT_OF_MEMORY = -11;
+static const int HOWLER_ERROR_SOCKET_ERROR = -12;
 
 /* Constant variables */
 static const unsigned short HOWLER_VENDOR_ID = 0x3EB;
@@ -115,6 +494,106 @@ static const unsigned short HOWLER_DEVICE_ID[MAX_HOWLER_DEVICE_IDS] =
 int howler_init(howler_context **);
 void howler_destroy(howler_context *);
 
+/* Options for attaching to an application that already uses libusb. A zeroed
+ * struct gives the behavior of howler_init.
+ *
+ * usb_ctx is a context owned by the application, which the library shares
+ * instead of creating its own. It is left open by howler_destroy.
+ *
+ * device_list and nDevices are the devices the application already got from
+ * libusb_get_device_list, which are searched instead of scanning the bus
+ * again. The list stays owned by the application.
+ *
+ * external_events is set when the application handles the events of usb_ctx
+ * itself, e.g. on its own event thread. howler_handle_events then only
+ * dispatches the input reports received and runs the timers of the library
+ * without waiting on libusb, and the application bounds its own waits with
+ * howler_next_deadline, which is due as soon as a report is received. The library is not thread
+ * safe: transfer callbacks run wherever libusb events are handled, so the
+ * application must not call into the library at the same time.
+ *
+ * log_level is the libusb log level of a context the library creates, from
+ * LIBUSB_LOG_LEVEL_NONE (the default) to LIBUSB_LOG_LEVEL_DEBUG.
+ *
+ * arena is the storage of the context in a static allocation build, and must
+ * stay valid until howler_destroy. When it is NULL the arena reserved by the
+ * library is used, which holds one context at a time; init fails with
+ * HOWLER_ERROR_OUT_OF_MEMORY when the arena is taken. Other builds ignore it.
+ */
+typedef struct {
+  libusb_context *usb_ctx;
+  libusb_device **device_list;
+  size_t nDevices;
+  int external_events;
+  int log_level;
+  howler_arena *arena;
+} howler_init_options;
+
+int howler_init_with_options(howler_context **ctx_ptr,
+                             const howler_init_options *options);
+
+/* Memory held by a context. context_bytes and device_bytes are the storage of
+ * the context and its devices, and total_bytes is all of the memory taken for
+ * them: the heap blocks, or in a static allocation build the whole arena.
+ * transfers is the number of libusb transfers held by the devices, which
+ * libusb allocates itself, as it does its own context and device lists. */
+typedef struct {
+  size_t context_bytes;
+  size_t device_bytes;
+  size_t total_bytes;
+  size_t transfers;
+} howler_memory_usage;
+
+int howler_get_memory_usage(const howler_context *ctx,
+                            howler_memory_usage *usage);
+
+/* Internal functions for the storage of the context and devices, which come
+ * from the heap or from arena in a static allocation build.
+ * howler_acquire_arena claims arena, or the library's own when it is NULL,
+ * and returns NULL when it is already in use. howler_alloc_devices returns
+ * zeroed room for *nDevices devices, lowering *nDevices to what the arena
+ * holds. howler_free_context also frees the devices of ctx and releases its
+ * arena. */
+howler_arena *howler_acquire_arena(howler_arena *arena);
+void howler_release_arena(howler_arena *arena);
+howler_device *howler_alloc_devices(howler_arena *arena, size_t *nDevices);
+void howler_free_devices(howler_arena *arena, howler_device *devices);
+howler_context *howler_alloc_context(howler_arena *arena);
+void howler_free_context(howler_context *ctx);
+
+/* Initialize a Howler context backed by nDevices virtual devices that are not
+ * connected to any hardware. Input reports can be fed to them with
+ * howler_inject_input_report, which makes them useful for testing. */
+int howler_init_virtual(howler_context **, size_t nDevices);
+
+/* howler_init remembers the devices it found in a small cache file, so that
+ * the next call can open them directly by their bus paths instead of scanning
+ * every USB device. Entries are checked against the device descriptor when
+ * they are opened, and any mismatch or missing device falls back to a full
+ * scan, which rewrites the cache. Devices plugged in since the cache was
+ * written are only found by a full scan; howler_invalidate_device_cache
+ * forces one. The firmware version of a device opened from the cache is read
+ * from the device the first time it is asked for, since a reflashed board
+ * looks the same otherwise.
+ *
+ * The cache lives in $HOWLER_DEVICE_CACHE, or $XDG_CACHE_HOME/howler-devices,
+ * or ~/.cache/howler-devices. Setting HOWLER_DEVICE_CACHE to an empty string
+ * disables it. */
+#define HOWLER_MAX_CACHED_DEVICES 16
+
+void howler_invalidate_device_cache(void);
+
+/* Internal functions for the device cache. howler_device_cache_load returns
+ * the number of entries read, or 0 if there is no usable cache. */
+int howler_device_cache_load(howler_device_info *entries, int max_entries);
+void howler_device_cache_save(const howler_context *ctx);
+
+/* Internal function that opens the device at a bus path through usbfs.
+ * Returns HOWLER_SUCCESS and the handle and file descriptor, which must be
+ * closed after the handle. */
+int howler_open_bus_path(libusb_context *usb_ctx, const char *bus_path,
+                         libusb_device_handle **handle, int *fd);
+
 /* Internal function used to send and receive messages from the howler device.
  * You should never need to call this function directly.
  */
@@ -137,16 +616,137 @@ howler_device *howler_get_device(howler_context *ctx,
  *
  ******************************************************************************/
 
+/* Returns what the device reported when it was opened. This doesn't
+ * communicate with the device. */
+const howler_device_info *howler_get_device_info(const howler_device *dev);
+
+/* Copies the transfer counters and queued command latencies of dev. */
+void howler_get_transfer_stats(const howler_device *dev,
+                               howler_transfer_stats *stats);
+
 /* Returns the version string for the associated device.
  * dst - A buffer to take the version string
  * dst_size - The size of dst in bytes
  * dst_len - The actual length of dst
+ * The version is only queried from the device if it wasn't known already.
  */
 int howler_get_device_version(howler_device *dev, char *dst,
                               size_t dst_size, size_t *dst_len);
 
+/* Scales the output of every LED by level / 255. The LED colors, and fades
+ * that the library sends as brightness changes, are relative to this
+ * level. */
 int howler_set_global_brightness(howler_device *dev, howler_led_channel level);
 
+/* Internal: resets the brightness of a newly opened device. */
+void howler_brightness_init(howler_brightness *brightness);
+
+/* Sets the gamma used to map LED values to hardware values. A gamma of 1.0
+ * (the default) is linear. The LEDs are updated to reflect the new curve. */
+int howler_set_gamma(howler_device *dev, float gamma);
+
+/* Scales the red, green and blue channels of every LED by the corresponding
+ * channel of white / 255. The default is full white (255, 255, 255). */
+int howler_set_white_balance(howler_device *dev, howler_led white);
+
+/* Limits the output of the given high powered LED to level / 255 of its
+ * full brightness. High powered LEDs are numbered from 1 to 2 */
+int howler_set_high_power_led_max_brightness(howler_device *dev,
+                                             unsigned char index,
+                                             howler_led_channel level);
+
+/*******************************************************************************
+ *
+ * LED Frames
+ *
+ ******************************************************************************/
+
+/* A frame holds the color of every LED on a device, in the order used by the
+ * firmware: joysticks 1-4, buttons 1-26 and then high powered LEDs 1-2. */
+typedef howler_led howler_led_frame[HOWLER_NUM_LEDS];
+
+#define HOWLER_LED_INDEX_JOYSTICK(joystick) ((joystick) - 1)
+#define HOWLER_LED_INDEX_BUTTON(button) (HOWLER_NUM_JOYSTICKS + (button) - 1)
+#define HOWLER_LED_INDEX_HIGH_POWER(index) \
+  (HOWLER_NUM_JOYSTICKS + HOWLER_NUM_BUTTONS + (index) - 1)
+
+/* Sets every LED of the device at once. Only the banks whose contents change
+ * are sent to the device. */
+int howler_set_led_frame(howler_device *dev, const howler_led *frame);
+
+/* Reads the current color of every LED from the shadow banks without
+ * communicating with the device. */
+int howler_get_led_frame(howler_led *frame, const howler_device *dev);
+
+/* Copies the color of every LED on every device of ctx into frames, one frame
+ * per device in device order, and returns the number of frames written, which
+ * is at most nFrames. By default the frames hold the colors set by the
+ * application, as with howler_get_led_frame, and nothing is sent to the
+ * devices. HOWLER_LED_STATE_HARDWARE copies the colors sent to the hardware
+ * after color correction instead.
+ *
+ * HOWLER_LED_STATE_FRESH reads the hardware colors back from the devices. The
+ * reads of every LED on every device are queued together at
+ * HOWLER_PRIORITY_READBACK and waited for once, and the hardware banks are
+ * updated with what the devices report. Virtual devices are copied from their
+ * banks. */
+#define HOWLER_LED_STATE_HARDWARE 0x1
+#define HOWLER_LED_STATE_FRESH 0x2
+
+int howler_get_led_state(howler_led_frame *frames, size_t nFrames,
+                         howler_context *ctx, unsigned int flags);
+
+/* Returns the frame index of a control named J#, B# or H#, or -1 if the
+ * name is not valid. Shared by every loader that names LEDs. */
+int howler_parse_led_name(const char *name);
+
+/* Internal function that scatters a frame into the bank layout. */
+void howler_led_frame_to_banks(howler_led_bank *banks, const howler_led *frame);
+
+/* Internal function that scatters a frame into banks and returns the mask of
+ * banks whose contents changed. Zero means the frame was a no-op. */
+unsigned int howler_led_frame_update_banks(howler_led_bank *banks,
+                                           const howler_led *frame);
+
+/* Internal function that gathers the bank layout back into a frame. */
+void howler_led_banks_to_frame(howler_led *frame, const howler_led_bank *banks);
+
+/* Internal function that compares two sets of banks and returns a mask with
+ * bit i set if bank i differs. */
+unsigned int howler_led_banks_diff(const howler_led_bank *a,
+                                   const howler_led_bank *b);
+
+/* Internal function that returns the level from 0 to 255 by which base can be
+ * scaled to give next, to within a step of rounding on every channel, or -1
+ * when next is not a uniformly scaled copy of base. */
+int howler_led_banks_uniform_scale(const howler_led_bank *next,
+                                   const howler_led_bank *base);
+
+/* Internal function that sends the banks in dirty_mask from led_banks, and
+ * records the ones that failed in failed_banks. */
+int howler_send_led_banks(howler_device *dev, unsigned int dirty_mask);
+
+/* Internal function to reset the color correction of dev to identity. */
+void howler_led_transform_init(howler_led_transform *xf);
+
+/* Internal function that applies the color correction to all 96 channels of
+ * the logical banks at once. */
+void howler_led_transform_apply(const howler_led_transform *xf,
+                                howler_led_bank *out,
+                                const howler_led_bank *in);
+
+/* Internal function to apply the color correction to a single channel. */
+howler_led_channel howler_led_transform_channel(const howler_led_transform *xf,
+                                                unsigned char bank,
+                                                unsigned char led,
+                                                howler_led_channel value);
+
+/* Internal function that recomputes the hardware banks of dev from its
+ * logical banks and sends the banks that changed. When the new banks are the
+ * hardware banks uniformly dimmed, as in a fade, only the global brightness
+ * is changed instead. */
+int howler_refresh_led_banks(howler_device *dev);
+
 /* Sets the RGB LED value of the given button
  * Buttons are numbered from 1 to 26 */
 int howler_set_button_led(howler_device *dev,
@@ -387,6 +987,707 @@ int howler_set_input_keyboard(howler_device *dev, howler_input ipt,
                               howler_key_scan_code code,
                               howler_key_modifiers modifiers);
 
+/* Returns the current mapping of an input. Mappings that were not set through
+ * the library are read from the device with CMD_GET_INPUT once and then
+ * remembered. */
+int howler_get_input_mapping(howler_input_mapping *out, howler_device *dev,
+                             howler_input ipt);
+
+/*******************************************************************************
+ *
+ * Power-on Defaults
+ *
+ ******************************************************************************/
+
+/* The firmware keeps a default color for every LED and a default mapping for
+ * every input, and applies them when the board powers up. Storing the
+ * current state as the defaults lets a cabinet come up correctly without any
+ * host traffic.
+ *
+ * howler_save_defaults sends CMD_SET_RGB_LED_DEFAULT for each LED, with the
+ * color it shows now after color correction and scaled by the global
+ * brightness and any fade, since the defaults are shown at full brightness.
+ * CMD_SET_DEFAULT is sent for each
+ * input, with its current mapping. The commands share the layouts of
+ * CMD_SET_RGB_LED and CMD_SET_INPUT, and go out back to back through the
+ * asynchronous command queue. With verify set, each command must be echoed
+ * back by the device like CMD_SET_INPUT is, and any command that is not
+ * echoed exactly fails the call with HOWLER_ERROR_VERIFY_FAILED. */
+#define HOWLER_DEFAULTS_LEDS 0x1
+#define HOWLER_DEFAULTS_INPUTS 0x2
+#define HOWLER_DEFAULTS_ALL (HOWLER_DEFAULTS_LEDS | HOWLER_DEFAULTS_INPUTS)
+
+int howler_save_defaults(howler_device *dev, unsigned int what, int verify);
+
+/*******************************************************************************
+ *
+ * Input Reports
+ *
+ ******************************************************************************/
+
+#define HOWLER_INPUT_INTERFACE 1
+#define HOWLER_INPUT_ENDPOINT 0x83
+#define HOWLER_INPUT_MASK_ALL \
+  ((((howler_input_mask)1) << (eHowlerInput_LAST + 1)) - 1)
+
+/* Returns the current CLOCK_MONOTONIC time in nanoseconds. All input
+ * timestamps reported by the library use this clock. */
+uint64_t howler_get_time_ns(void);
+
+/* Decodes a raw 24 byte input report into the state of every input. The first
+ * six bytes of the report hold a little endian bitmask indexed by howler_input.
+ */
+howler_input_mask howler_parse_input_report(const unsigned char *report);
+
+/* Claims the input interface of every connected device and starts listening
+ * for input reports. Reports are only delivered while the application calls
+ * howler_handle_events. */
+int howler_start_input(howler_context *ctx);
+void howler_stop_input(howler_context *ctx);
+
+/* Processes pending USB events, waiting at most timeout_ms milliseconds for
+ * one to arrive. All input callbacks are called from within this function,
+ * after libusb has returned, so they may use the synchronous API. Reports that
+ * arrive while the library handles events elsewhere, e.g. during a
+ * synchronous command, are held until the next call. */
+int howler_handle_events(howler_context *ctx, int timeout_ms);
+
+/* Returns the time on the howler_get_time_ns clock at which the library next
+ * needs howler_handle_events to be called for its timers, or 0 if it has
+ * none. Applications that handle libusb events themselves use it to bound
+ * their waits. */
+uint64_t howler_next_deadline(const howler_context *ctx);
+
+/* Sets the callbacks that are called for each input that is pressed or
+ * released. The button argument is the corresponding howler_input. */
+void howler_set_input_callbacks(howler_context *ctx,
+                                howler_button_callback key_down,
+                                howler_button_callback key_up,
+                                void *user_data);
+
+/* Sets the callback that receives each input edge along with its timestamps.
+ * This is called before the key_down and key_up callbacks. */
+void howler_set_input_event_callback(howler_context *ctx,
+                                     howler_input_event_callback callback,
+                                     void *user_data);
+
+/* Sets the callback that receives each input report as a whole */
+void howler_set_report_callback(howler_context *ctx,
+                                howler_report_callback callback,
+                                void *user_data);
+
+/* Internal function used to dispatch an input report received from dev to the
+ * registered callbacks. */
+void howler_process_input_report(howler_device *dev,
+                                 const unsigned char *report,
+                                 uint64_t arrival_ns);
+
+/* Internal function used to run the debouncing timers of every device. It
+ * dispatches the edges whose debouncing has completed by now_ns. */
+void howler_process_input_timers(howler_context *ctx, uint64_t now_ns);
+
+/* Internal function that returns the earliest time at which
+ * howler_process_input_timers needs to run, or zero if no timer is pending. */
+uint64_t howler_next_input_deadline(const howler_context *ctx);
+
+/* Configures how the given input is debounced. The meaning of param depends
+ * on the mode: it is the hold-off period in milliseconds for
+ * HOWLER_DEBOUNCE_TIME and the number of samples for
+ * HOWLER_DEBOUNCE_INTEGRATOR. It is ignored for HOWLER_DEBOUNCE_NONE. */
+int howler_set_input_debounce(howler_device *dev, howler_input ipt,
+                              howler_debounce_mode mode, unsigned int param);
+
+/* Internal function that applies the debouncing configuration of dev to a new
+ * raw input state and returns the debounced state. */
+howler_input_mask howler_debounce_update(howler_device *dev,
+                                         howler_input_mask raw,
+                                         uint64_t now_ns);
+
+/* Internal function returning the next time at which the debouncing state of
+ * dev needs to be reevaluated, or zero if nothing is pending. */
+uint64_t howler_debounce_deadline(const howler_device *dev);
+
+/* Processes report as if it had been received from dev at arrival_ns. If
+ * arrival_ns is zero, the current time is used. */
+int howler_inject_input_report(howler_device *dev,
+                               const unsigned char *report,
+                               uint64_t arrival_ns);
+
+/* Copies the histogram of input dispatch delays into out */
+void howler_get_input_latency(howler_context *ctx,
+                              howler_latency_histogram *out);
+void howler_reset_input_latency(howler_context *ctx);
+
+void howler_latency_histogram_reset(howler_latency_histogram *hist);
+void howler_latency_histogram_add(howler_latency_histogram *hist,
+                                  uint64_t ns);
+
+/* Returns an upper bound on the given percentile (0-100) of the samples in the
+ * histogram, accurate to within a factor of two. */
+uint64_t howler_latency_histogram_percentile(
+  const howler_latency_histogram *hist, double percentile);
+
+/*******************************************************************************
+ *
+ * Asynchronous Commands
+ *
+ ******************************************************************************/
+
+/* Queues a HOWLER_COMMAND_SIZE byte command for the device without blocking.
+ * Commands are sent from howler_handle_events, and callback, if not NULL, is
+ * called from there once the command has been written and, when
+ * expects_response is set, its response has been read. status is
+ * HOWLER_SUCCESS or a negative error, and response is NULL unless a response
+ * was read. callback runs inside libusb event handling, so it must not use
+ * the synchronous API: a synchronous command cannot be waited for there and
+ * fails with HOWLER_ERROR_LIBUSB_TRANSFER_ERROR, though it is still sent.
+ * Returns HOWLER_ERROR_QUEUE_FULL when HOWLER_COMMAND_QUEUE_DEPTH
+ * commands of the same priority are already pending.
+ *
+ * The priority is picked from the command byte: configuration and version
+ * queries are HOWLER_PRIORITY_CONTROL, key mappings HOWLER_PRIORITY_INPUT, LED
+ * writes HOWLER_PRIORITY_LED and LED reads HOWLER_PRIORITY_READBACK. Higher
+ * classes go first, so a remap never waits behind a backlog of bank writes,
+ * but a class that has been passed over HOWLER_COMMAND_MAX_BYPASS times in a
+ * row is served next. Commands of the same class keep their order, and a
+ * readback is never sent before any command submitted ahead of it. */
+#define HOWLER_COMMAND_MAX_BYPASS 8
+
+int howler_submit_command(howler_device *dev, const unsigned char *cmd,
+                          int expects_response,
+                          howler_command_callback callback, void *user_data);
+int howler_submit_command_with_priority(howler_device *dev,
+                                        howler_command_priority priority,
+                                        const unsigned char *cmd,
+                                        int expects_response,
+                                        howler_command_callback callback,
+                                        void *user_data);
+
+howler_command_priority howler_command_default_priority(const unsigned char *cmd);
+
+/* Returns the number of commands that have been submitted to the device but
+ * not yet completed. */
+size_t howler_pending_commands(const howler_device *dev);
+
+/* Returns how many more commands of the given priority can be queued. */
+size_t howler_command_queue_space(const howler_device *dev,
+                                  howler_command_priority priority);
+
+/* Internal: handles events until a command of the given priority can be
+ * queued, without waiting for the rest of the queue. */
+int howler_wait_for_queue_space(howler_device *dev,
+                                howler_command_priority priority);
+
+/* Internal: adds cmd to its class queue, or takes the next command to send
+ * according to the priority rules. howler_command_queue_pop returns 0 when
+ * nothing is waiting. */
+int howler_command_queue_push(howler_command_queue *q,
+                              howler_command_priority priority,
+                              const howler_command *cmd);
+int howler_command_queue_pop(howler_command_queue *q, howler_command *out);
+
+/* Internal: detaches the callback of every pending command, including the
+ * one on the wire, that carries user_data, for a caller that stops waiting
+ * before its commands complete. */
+void howler_command_queue_forget(howler_command_queue *q,
+                                 const void *user_data);
+
+/* Blocks until every submitted command has completed. */
+int howler_flush_commands(howler_device *dev);
+
+/* Queues CMD_SET_RGB_LED_BANK commands for the banks that differ from the
+ * hardware after color correction, or a single CMD_SET_GLOBAL_BRIGHTNESS for
+ * a fade, like howler_refresh_led_banks. callback is attached to the last of
+ * them. Returns the number of commands queued, which is
+ * zero when the hardware is already up to date and callback will not be
+ * called. */
+int howler_refresh_led_banks_async(howler_device *dev,
+                                   howler_command_callback callback,
+                                   void *user_data);
+
+/* Internal: fails every pending command with HOWLER_ERROR_CANCELLED. */
+void howler_cancel_commands(howler_device *dev);
+
+/* Internal: allocates the transfers of the queue when the device is opened,
+ * and frees them when it is closed. */
+int howler_alloc_command_transfers(howler_device *dev);
+void howler_free_command_transfers(howler_device *dev);
+
+/*******************************************************************************
+ *
+ * LED Frame Pacing
+ *
+ ******************************************************************************/
+
+/* Commits a frame without blocking. The frame is sent through the
+ * asynchronous command queue as soon as the device has finished with the
+ * previous one, so the rate adapts to how fast the device takes bank writes.
+ * A frame committed while another is still waiting to be sent replaces it,
+ * which keeps the lights at most one frame behind the application. */
+int howler_commit_led_frame(howler_device *dev, const howler_led *frame);
+
+/* Internal: commits the logical banks of dev after they were rewritten in
+ * place. changed is the mask of banks whose contents changed, and zero means
+ * the commit repeated the previous frame. */
+int howler_commit_led_banks(howler_device *dev, unsigned int changed);
+
+/* Internal: commits the banks of dev marked in marked_banks. */
+int howler_commit_marked_banks(howler_device *dev);
+
+/* Number of identical commits in a row after which a device counts as
+ * static. */
+#define HOWLER_LED_QUIESCENT_COMMITS 2
+
+/* Sets the shortest time between the starts of two frames, e.g. to match
+ * the display refresh rate. Zero, the default, sends frames as fast as the
+ * device completes them. */
+void howler_set_led_frame_interval(howler_device *dev, uint64_t interval_ns);
+
+typedef struct {
+  unsigned long long committed;
+  unsigned long long sent;
+  unsigned long long dropped;
+  unsigned long long unchanged;
+  unsigned long long identical;
+  unsigned long long banks_avoided;
+  unsigned long long errors;
+  unsigned long long fades;
+  int quiescent;
+
+  uint64_t rtt_avg_ns;
+  uint64_t rtt_min_ns;
+  uint64_t rtt_max_ns;
+} howler_led_frame_stats;
+
+/* Frames that were sent, replaced by a later frame before being sent
+ * (dropped), found identical to the hardware state after color correction
+ * (unchanged), or identical to the previous frame and skipped outright
+ * (identical), along with the bank writes that were avoided and the round
+ * trip time of the frames that were sent. fades counts the frames that were
+ * sent as a single change of the global brightness. */
+void howler_get_led_frame_stats(const howler_device *dev,
+                                howler_led_frame_stats *stats);
+
+/* Internal: sends the pending frames that are due, and returns the earliest
+ * time a paced frame is waiting for, or 0 if there is none. */
+void howler_pump_led_frames(howler_context *ctx, uint64_t now_ns);
+uint64_t howler_next_led_frame_deadline(const howler_context *ctx);
+
+/* Returns 1 when no device has a frame waiting or in flight, no timeline is
+ * playing and the recent commits to every device repeated the previous
+ * frame. Nothing in the LED
+ * path needs a wakeup then, so animation loops driven by the application can
+ * stop their timers until the scene changes. */
+int howler_led_frames_quiescent(const howler_context *ctx);
+
+/*******************************************************************************
+ *
+ * LED Groups
+ *
+ ******************************************************************************/
+
+/* A named group of LEDs, which may be spread over several devices. The group
+ * is planned once against a context: for every device it touches, the plan
+ * holds the slots of each bank that belong to the group. Setting the group
+ * rewrites only those slots and commits every device once, as with
+ * howler_commit_led_frame, so only the banks that changed are sent and the
+ * devices are written concurrently by howler_handle_events. */
+#define HOWLER_LED_GROUP_NAME_SIZE 32
+#ifndef HOWLER_MAX_GROUP_DEVICES
+#define HOWLER_MAX_GROUP_DEVICES 8
+#endif
+
+/* An LED of a device, by its index in a howler_led_frame. */
+typedef struct {
+  unsigned int device;
+  unsigned char led;
+} howler_led_ref;
+
+/* Bit i of slots[b] is set when slot i of bank b belongs to the group. */
+typedef struct {
+  unsigned int device;
+  uint16_t slots[6];
+} howler_led_group_plan;
+
+typedef struct {
+  char name[HOWLER_LED_GROUP_NAME_SIZE];
+  size_t nPlans;
+  howler_led_group_plan plans[HOWLER_MAX_GROUP_DEVICES];
+} howler_led_group;
+
+/* Plans a group of the nLeds LEDs in leds on the devices of ctx. */
+int howler_led_group_init(howler_led_group *group, const char *name,
+                          const howler_context *ctx,
+                          const howler_led_ref *leds, size_t nLeds);
+
+/* Sets every LED of the group to color, or one channel of every LED to
+ * value. */
+int howler_set_led_group(howler_context *ctx, const howler_led_group *group,
+                         howler_led color);
+int howler_set_led_group_channel(howler_context *ctx,
+                                 const howler_led_group *group,
+                                 howler_led_channel_name channel,
+                                 howler_led_channel value);
+
+/* Loads up to maxGroups groups from a file with one group per line: its name
+ * followed by its LEDs as DEVICE:CONTROL, or just CONTROL on device 0, where
+ * CONTROL is J#, B# or H#. For example "p1-buttons 0:B1 0:B2 1:B1". Returns
+ * the number of groups loaded. */
+int howler_led_groups_load(howler_led_group *groups, size_t maxGroups,
+                           const howler_context *ctx, const char *path);
+
+/* Returns the group called name, or NULL if there is none. */
+const howler_led_group *howler_find_led_group(const howler_led_group *groups,
+                                              size_t nGroups,
+                                              const char *name);
+
+/* Internal: writes values[c] into the slots of the group in the banks of
+ * bank_mask, where banks 2c and 2c + 1 hold channel c, and marks the banks
+ * that changed in the marked_banks of their device. */
+int howler_led_group_write(howler_context *ctx, const howler_led_group *group,
+                           const howler_led_channel *values,
+                           unsigned int bank_mask);
+
+/*******************************************************************************
+ *
+ * Input Reactions
+ *
+ ******************************************************************************/
+
+/* Reactions change LEDs on input edges from within the input path, before
+ * any of the input callbacks run. The LEDs they change are committed like a
+ * frame from howler_commit_led_frame as soon as the report is processed, so
+ * the bank writes go out with the next USB transfer rather than after a trip
+ * through the application.
+ *
+ * Each rule watches one input of one device and has an action for the press
+ * and one for the release of that input:
+ *  - HOWLER_REACTION_SET_COLOR sets the LEDs of group to color, remembering
+ *    the colors they had unless the rule already holds some.
+ *  - HOWLER_REACTION_RESTORE puts back the colors the rule remembered.
+ *  - HOWLER_REACTION_PLAY_TIMELINE starts timeline, like
+ *    howler_play_timeline, and HOWLER_REACTION_STOP_TIMELINE stops it.
+ * "Light the button while it is pressed" is then SET_COLOR on press and
+ * RESTORE on release. */
+typedef enum {
+  HOWLER_REACTION_NONE = 0,
+  HOWLER_REACTION_SET_COLOR,
+  HOWLER_REACTION_RESTORE,
+  HOWLER_REACTION_PLAY_TIMELINE,
+  HOWLER_REACTION_STOP_TIMELINE
+} howler_reaction_action;
+
+typedef struct howler_reaction {
+  unsigned int device;
+  howler_input input;
+  howler_reaction_action on_press;
+  howler_reaction_action on_release;
+
+  const howler_led_group *group;
+  howler_led color;
+  struct howler_timeline *timeline;
+  int loop;
+
+  // Internal: the colors of the group's devices before SET_COLOR, indexed
+  // like the plans of the group.
+  int saved;
+  howler_led_bank saved_banks[HOWLER_MAX_GROUP_DEVICES][6];
+} howler_reaction;
+
+/* Installs nRules rules, replacing any that were installed before. The rules
+ * and the groups and timelines they use stay owned by the application and
+ * must stay valid until they are replaced or ctx is destroyed. Passing no
+ * rules removes them. */
+int howler_set_reactions(howler_context *ctx, howler_reaction *rules,
+                         size_t nRules);
+
+/* Internal: runs the rules for the inputs of dev in changed, which now have
+ * the values in state, and commits the LEDs they change. */
+void howler_run_reactions(howler_device *dev, howler_input_mask changed,
+                          howler_input_mask state);
+
+/*******************************************************************************
+ *
+ * Ambient Lighting
+ *
+ ******************************************************************************/
+
+/* Ambient lighting sets LEDs to the average color of regions of a video
+ * frame. A layout gives each LED its region as fractions of the screen, with
+ * lines of the form
+ *
+ *     B1 0.0 0.8 0.1 0.2
+ *
+ * holding a control (J#, B# or H#) and the x, y, width and height of its
+ * region, and optionally a line "smoothing S" where S from 0 up to 1 is the
+ * share of the previous color kept at each frame. '#' starts a comment. */
+typedef struct {
+  float x;
+  float y;
+  float width;
+  float height;
+} howler_ambient_region;
+
+typedef struct {
+  unsigned char mapped[HOWLER_NUM_LEDS];
+  howler_ambient_region regions[HOWLER_NUM_LEDS];
+  float smoothing;
+} howler_ambient_layout;
+
+int howler_ambient_layout_load(howler_ambient_layout *layout, const char *path);
+
+typedef struct {
+  unsigned int x0, y0;
+  unsigned int x1, y1;
+} howler_ambient_rect;
+
+/* A layout fitted to frames of a given size. Frames are packed 8-bit RGB with
+ * stride bytes from one row to the next. */
+typedef struct {
+  howler_ambient_layout layout;
+  unsigned int width;
+  unsigned int height;
+  size_t stride;
+
+  howler_ambient_rect rects[HOWLER_NUM_LEDS];
+  unsigned int alpha;
+
+  // Smoothed colors with eight fractional bits.
+  uint16_t smoothed[HOWLER_NUM_LEDS][3];
+  int primed;
+} howler_ambient;
+
+int howler_ambient_init(howler_ambient *amb, const howler_ambient_layout *layout,
+                        unsigned int width, unsigned int height, size_t stride);
+
+/* Averages the region of every mapped LED in rgb, smooths the result and
+ * stores it in frame. LEDs without a region are left alone. */
+void howler_ambient_sample(howler_ambient *amb, const unsigned char *rgb,
+                           howler_led *frame);
+
+/* Samples rgb and commits the result to dev with howler_commit_led_frame, so
+ * a video source can call it once per frame without blocking. */
+int howler_ambient_commit(howler_device *dev, howler_ambient *amb,
+                          const unsigned char *rgb);
+
+/*******************************************************************************
+ *
+ * LED Timelines
+ *
+ ******************************************************************************/
+
+/* A timeline is a precompiled light show: the bank contents of one or more
+ * devices at recorded times, as built by howler-timeline from a text
+ * description. The file is memory mapped and streamed from front to back,
+ * so playback uses the same memory however long the show is.
+ *
+ * A timeline starts with the eight bytes "HWLTIMEL" followed by, in little
+ * endian order, the 32-bit version, the number of devices, the number of
+ * frames, a reserved word and the duration of the show in nanoseconds (64
+ * bits). Each frame holds its time since the start of the show in
+ * nanoseconds (64 bits), the device index, a mask of the banks it contains,
+ * two reserved bytes and then the 16 bytes of each bank in the mask, from
+ * the lowest bank up. Frames are sorted by time, and the first frame of every
+ * device contains all six banks so that the rest can hold only the banks that
+ * changed. */
+#define HOWLER_TIMELINE_MAGIC "HWLTIMEL"
+#define HOWLER_TIMELINE_VERSION 1
+#define HOWLER_TIMELINE_HEADER_SIZE 32
+#define HOWLER_TIMELINE_FRAME_HEADER_SIZE 12
+
+typedef struct howler_timeline {
+  const unsigned char *data;
+  size_t size;
+  unsigned int num_devices;
+  unsigned int num_frames;
+  uint64_t duration_ns;
+
+  // Playback position: the offset of the next frame and when the current
+  // pass over the show started.
+  size_t offset;
+  uint64_t start_ns;
+  int loop;
+} howler_timeline;
+
+int howler_timeline_open(howler_timeline *tl, const char *path);
+void howler_timeline_close(howler_timeline *tl);
+
+/* Starts playing tl on the devices of ctx, optionally over and over. Frames
+ * go out through howler_commit_led_frame's pacing at their recorded times
+ * while the application calls howler_handle_events. Timeline device i plays on
+ * device i of ctx, and frames for devices that are not connected are
+ * skipped. Only one timeline plays at a time, and tl must stay open while it
+ * plays. */
+int howler_play_timeline(howler_context *ctx, howler_timeline *tl, int loop);
+void howler_stop_timeline(howler_context *ctx);
+
+/* Returns 1 while a timeline is playing. */
+int howler_timeline_playing(const howler_context *ctx);
+
+/* Internal: commits the frames of the playing timeline that are due, and
+ * returns the time the next one is due, or 0 if nothing is playing. */
+void howler_pump_timeline(howler_context *ctx, uint64_t now_ns);
+uint64_t howler_next_timeline_deadline(const howler_context *ctx);
+
+/* Writing timelines. The header is written first with the final frame count
+ * and duration, or rewritten once they are known. Each frame holds the banks
+ * of dev in bank_mask. */
+int howler_timeline_write_header(FILE *fp, unsigned int num_devices,
+                                 unsigned int num_frames, uint64_t duration_ns);
+int howler_timeline_write_frame(FILE *fp, uint64_t time_ns, unsigned char dev,
+                                unsigned int bank_mask,
+                                const howler_led_bank *banks);
+
+/*******************************************************************************
+ *
+ * Traffic Recording
+ *
+ ******************************************************************************/
+
+/* Every command sent to a device and every response read back can be written
+ * to a trace file for later analysis with howler-replay. Recording starts at
+ * initialization when the HOWLER_TRACE environment variable names a file.
+ *
+ * A trace starts with the eight bytes "HWLTRACE" and a little endian 32-bit
+ * version, followed by fixed size records holding, in little endian order,
+ * the time since the start of the recording in nanoseconds (64 bits), the
+ * device index, the record kind, the signed status of the transfer, a
+ * reserved byte and the HOWLER_COMMAND_SIZE bytes of the frame. */
+#define HOWLER_TRACE_MAGIC "HWLTRACE"
+#define HOWLER_TRACE_VERSION 1
+#define HOWLER_TRACE_RECORD_SIZE (12 + HOWLER_COMMAND_SIZE)
+
+typedef enum {
+  HOWLER_TRACE_COMMAND = 0,
+  HOWLER_TRACE_RESPONSE
+} howler_trace_kind;
+
+typedef struct {
+  uint64_t time_ns;
+  unsigned char device;
+  unsigned char kind;
+  signed char status;
+  unsigned char data[HOWLER_COMMAND_SIZE];
+} howler_trace_record;
+
+int howler_start_recording(howler_context *ctx, const char *path);
+void howler_stop_recording(howler_context *ctx);
+
+/* Internal: appends a frame sent to or read from dev to the trace. Commands
+ * are stamped when their transfer starts and responses when they arrive, so
+ * that the two bracket the whole round trip. */
+void howler_record_frame(howler_device *dev, howler_trace_kind kind,
+                         uint64_t time_ns, int status,
+                         const unsigned char *frame);
+
+/* Reading traces back. howler_trace_read_header returns HOWLER_SUCCESS for a
+ * readable trace, and howler_trace_read_record returns 1 for each record and
+ * 0 at the end of the file. */
+int howler_trace_read_header(FILE *fp);
+int howler_trace_read_record(FILE *fp, howler_trace_record *record);
+
+/*******************************************************************************
+ *
+ * Span Tracing
+ *
+ ******************************************************************************/
+
+/* When the library is built with HOWLER_TRACING, it can record how long it
+ * spends in USB round trips, LED frame commits, bank writes, input dispatch
+ * and initialization. Each thread records into its own buffer without
+ * locking, and howler_tracing_write_json exports everything in the Chrome
+ * trace event format, which loads in Perfetto and chrome://tracing.
+ *
+ * howler_tracing_start returns HOWLER_ERROR_UNSUPPORTED when tracing was not
+ * compiled in. events_per_thread bounds the memory used by each thread; once
+ * a buffer is full, further spans on that thread are counted as dropped.
+ *
+ * Any program can be traced without changes by setting the HOWLER_SPANS
+ * environment variable to a file name: howler_init then starts tracing, and
+ * howler_destroy writes the spans to that file. */
+int howler_tracing_start(size_t events_per_thread);
+void howler_tracing_stop(void);
+int howler_tracing_write_json(const char *path);
+
+/* Internal: spans are bracketed with HOWLER_SPAN_BEGIN and HOWLER_SPAN_END.
+ * name must be a string literal. */
+uint64_t howler_span_begin(void);
+void howler_span_end(const char *name, uint64_t start_ns, int arg);
+
+#ifdef HOWLER_ENABLE_TRACING
+#  define HOWLER_SPAN_BEGIN(span) uint64_t span = howler_span_begin()
+#  define HOWLER_SPAN_END(span, name, arg) howler_span_end(name, span, arg)
+#else
+#  define HOWLER_SPAN_BEGIN(span) do { } while(0)
+#  define HOWLER_SPAN_END(span, name, arg) do { } while(0)
+#endif
+
+/*******************************************************************************
+ *
+ * Metrics
+ *
+ ******************************************************************************/
+
+/* The metrics exporter serves the counters and latency histograms of a
+ * context over HTTP in the Prometheus text format: transfers and failures,
+ * queued command latency, LED frames sent, dropped and skipped, input reports
+ * and events, input dispatch latency and the time taken by init.
+ *
+ * address is either the path of a Unix socket, optionally prefixed with
+ * "unix:", or PORT or HOST:PORT for a TCP socket, where HOST is an IPv4
+ * address and defaults to 127.0.0.1.
+ *
+ * Scrapes are answered on a thread of the exporter, which reads the counters
+ * while the thread running howler_handle_events updates them, so the event
+ * loop does no work for the exporter. The counters are read one at a time,
+ * and a scrape may land between related updates. The exporter must be
+ * stopped before ctx is destroyed. */
+typedef struct howler_metrics_exporter howler_metrics_exporter;
+
+int howler_metrics_start(howler_metrics_exporter **exporter,
+                         howler_context *ctx,
+                         const char *address);
+void howler_metrics_stop(howler_metrics_exporter *exporter);
+
+/* Writes the metrics of ctx to fd in the Prometheus text format. */
+int howler_metrics_write(const howler_context *ctx, int fd);
+
+/*******************************************************************************
+ *
+ * uinput Bridge
+ *
+ ******************************************************************************/
+
+/* The uinput bridge exposes every connected Howler as a native joystick
+ * through /dev/uinput. Joystick directions become the axes ABS_X/ABS_Y,
+ * ABS_RX/ABS_RY, ABS_HAT0X/ABS_HAT0Y and ABS_HAT1X/ABS_HAT1Y, and the buttons
+ * become BTN_TRIGGER through BTN_DEAD followed by BTN_TRIGGER_HAPPY. All of the
+ * events from one input report are written together, terminated by a single
+ * SYN_REPORT. */
+typedef struct howler_uinput_bridge howler_uinput_bridge;
+
+typedef struct {
+  unsigned long long reports;
+  unsigned long long events;
+  unsigned long long write_errors;
+
+  // Time from the arrival of an input report to the completion of the write
+  // to /dev/uinput, in nanoseconds.
+  uint64_t latency_min_ns;
+  uint64_t latency_max_ns;
+  uint64_t latency_total_ns;
+} howler_uinput_stats;
+
+/* Creates one uinput device per connected Howler and registers the bridge as
+ * the report callback of ctx. Input must be started separately with
+ * howler_start_input. */
+int howler_uinput_bridge_create(howler_uinput_bridge **bridge,
+                                howler_context *ctx);
+void howler_uinput_bridge_destroy(howler_uinput_bridge *bridge);
+
+void howler_uinput_bridge_get_stats(const howler_uinput_bridge *bridge,
+                                    howler_uinput_stats *stats);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,341 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __HOWLER_LIB_HPP__
+#define __HOWLER_LIB_HPP__
+
+/* C++17 interface to libhowler. Contexts, devices and frames are move-only
+ * types that clean up after themselves, errors are reported as howler::Error
+ * exceptions, and LEDs are addressed with types such as howler::Button<7>
+ * whose bank locations are resolved at compile time:
+ *
+ *   howler::Context ctx;
+ *   howler::Device dev = ctx.device(0);
+ *   {
+ *     howler::Frame frame = dev.frame();
+ *     frame.set(howler::Button<7>{}, { { 255, 0, 0 } });
+ *     frame.set(howler::Joystick<2>{}, { { 0, 0, 255 } });
+ *   } // Committed here
+ *
+ * The bank locations come from howler_led_map.h, which the build generates
+ * and installs next to howler.h. */
+
+#include "howler.h"
+#include "howler_led_map.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace howler {
+
+class Error : public std::runtime_error {
+ public:
+  Error(int code, const char *what) : std::runtime_error(what), code_(code) { }
+  int code() const noexcept { return code_; }
+
+ private:
+  int code_;
+};
+
+namespace detail {
+
+inline void check(int err, const char *what) {
+  if(err < 0) {
+    throw Error(err, what);
+  }
+}
+
+inline constexpr unsigned char kLedToBank[HOWLER_NUM_LEDS][3][2] =
+  HOWLER_LED_TO_BANK_INIT;
+
+template <typename Control>
+howler_led get_led(const howler_led_bank *banks) noexcept {
+  howler_led led;
+  led.red = banks[Control::kBank[0]][Control::kSlot[0]];
+  led.green = banks[Control::kBank[1]][Control::kSlot[1]];
+  led.blue = banks[Control::kBank[2]][Control::kSlot[2]];
+  return led;
+}
+
+}  // namespace detail
+
+/* Compile-time LED addresses. Each names a slot in a howler_led_frame and the
+ * bank locations of its red, green and blue channels. */
+template <unsigned kIndex>
+struct Led {
+  static_assert(kIndex < HOWLER_NUM_LEDS, "LED index out of range");
+  static constexpr unsigned kFrameIndex = kIndex;
+  static constexpr unsigned char kBank[3] = {
+    detail::kLedToBank[kIndex][0][0],
+    detail::kLedToBank[kIndex][1][0],
+    detail::kLedToBank[kIndex][2][0],
+  };
+  static constexpr unsigned char kSlot[3] = {
+    detail::kLedToBank[kIndex][0][1],
+    detail::kLedToBank[kIndex][1][1],
+    detail::kLedToBank[kIndex][2][1],
+  };
+};
+
+template <unsigned kButton>
+struct Button : Led<HOWLER_LED_INDEX_BUTTON(kButton)> {
+  static_assert(kButton >= 1 && kButton <= HOWLER_NUM_BUTTONS,
+                "Buttons are numbered from 1 to 26");
+};
+
+template <unsigned kJoystick>
+struct Joystick : Led<HOWLER_LED_INDEX_JOYSTICK(kJoystick)> {
+  static_assert(kJoystick >= 1 && kJoystick <= HOWLER_NUM_JOYSTICKS,
+                "Joysticks are numbered from 1 to 4");
+};
+
+template <unsigned kHighPower>
+struct HighPower : Led<HOWLER_LED_INDEX_HIGH_POWER(kHighPower)> {
+  static_assert(kHighPower >= 1 && kHighPower <= HOWLER_NUM_HIGH_POWER_LEDS,
+                "High powered LEDs are numbered from 1 to 2");
+};
+
+/* A batch of LED changes that is sent to the device as a whole when it is
+ * committed or goes out of scope. Only the banks that changed are written. */
+class Frame {
+ public:
+  explicit Frame(howler_device *dev) : dev_(dev), dirty_(false) {
+    std::memcpy(banks_, dev->logical_banks, sizeof(banks_));
+  }
+
+  Frame(const Frame &) = delete;
+  Frame &operator=(const Frame &) = delete;
+
+  Frame(Frame &&other) noexcept : dev_(other.dev_), dirty_(other.dirty_) {
+    std::memcpy(banks_, other.banks_, sizeof(banks_));
+    other.dev_ = nullptr;
+  }
+
+  Frame &operator=(Frame &&other) noexcept {
+    if(this != &other) {
+      commit_noexcept();
+      dev_ = std::exchange(other.dev_, nullptr);
+      dirty_ = other.dirty_;
+      std::memcpy(banks_, other.banks_, sizeof(banks_));
+    }
+    return *this;
+  }
+
+  ~Frame() { commit_noexcept(); }
+
+  template <typename Control>
+  Frame &set(Control, howler_led led) noexcept {
+    banks_[Control::kBank[0]][Control::kSlot[0]] = led.red;
+    banks_[Control::kBank[1]][Control::kSlot[1]] = led.green;
+    banks_[Control::kBank[2]][Control::kSlot[2]] = led.blue;
+    dirty_ = true;
+    return *this;
+  }
+
+  /* Sets one channel of the LED. Channels other than red, green and blue
+   * are ignored. */
+  template <typename Control>
+  Frame &set(Control, howler_led_channel_name channel,
+             howler_led_channel value) noexcept {
+    assert(static_cast<unsigned>(channel) <= HOWLER_LED_CHANNEL_BLUE);
+    if(static_cast<unsigned>(channel) > HOWLER_LED_CHANNEL_BLUE) {
+      return *this;
+    }
+
+    banks_[Control::kBank[channel]][Control::kSlot[channel]] = value;
+    dirty_ = true;
+    return *this;
+  }
+
+  template <typename Control>
+  howler_led get(Control) const noexcept {
+    return detail::get_led<Control>(banks_);
+  }
+
+  /* Replaces the whole frame */
+  Frame &set_all(const howler_led_frame &frame) noexcept {
+    howler_led_frame_to_banks(banks_, frame);
+    dirty_ = true;
+    return *this;
+  }
+
+  /* Sends the frame if it changed, and retries any banks of the device whose
+   * last write failed either way. A frame without changes leaves the colors
+   * of the device as they are, even if they were set after it was made. */
+  void commit() {
+    if(!dev_ || (!dirty_ && !dev_->failed_banks)) {
+      return;
+    }
+
+    if(dirty_) {
+      std::memcpy(dev_->logical_banks, banks_, sizeof(banks_));
+      dirty_ = false;
+    }
+    detail::check(howler_refresh_led_banks(dev_), "Unable to commit LED frame");
+  }
+
+  /* Drops the changes made since the last commit */
+  void discard() noexcept {
+    if(dev_) {
+      std::memcpy(banks_, dev_->logical_banks, sizeof(banks_));
+    }
+    dirty_ = false;
+  }
+
+ private:
+  void commit_noexcept() noexcept {
+    try {
+      commit();
+    } catch(const Error &) {
+      // Nothing to report to from a destructor; the device remembers the
+      // banks that failed and the next commit to it sends them again.
+    }
+  }
+
+  howler_device *dev_;
+  bool dirty_;
+  howler_led_bank banks_[6];
+};
+
+/* A device belonging to a Context. It must not outlive the context. */
+class Device {
+ public:
+  explicit Device(howler_device *dev) : dev_(dev) { }
+
+  Device(const Device &) = delete;
+  Device &operator=(const Device &) = delete;
+  Device(Device &&other) noexcept : dev_(std::exchange(other.dev_, nullptr)) { }
+  Device &operator=(Device &&other) noexcept {
+    dev_ = std::exchange(other.dev_, nullptr);
+    return *this;
+  }
+
+  Frame frame() { return Frame(dev_); }
+
+  template <typename Control>
+  void set_led(Control c, howler_led led) {
+    Frame f(dev_);
+    f.set(c, led);
+    f.commit();
+  }
+
+  template <typename Control>
+  howler_led led(Control) const noexcept {
+    return detail::get_led<Control>(dev_->logical_banks);
+  }
+
+  void set_global_brightness(howler_led_channel level) {
+    detail::check(howler_set_global_brightness(dev_, level),
+                  "Unable to set global brightness");
+  }
+
+  void set_gamma(float gamma) {
+    detail::check(howler_set_gamma(dev_, gamma), "Unable to set gamma");
+  }
+
+  void set_input_keyboard(howler_input ipt, howler_key_scan_code code,
+                          howler_key_modifiers modifiers = eHowlerKeyModifier_None) {
+    detail::check(howler_set_input_keyboard(dev_, ipt, code, modifiers),
+                  "Unable to set keyboard mapping");
+  }
+
+  std::string firmware_version() const {
+    char buf[32];
+    size_t len = 0;
+    detail::check(howler_get_device_version(dev_, buf, sizeof(buf), &len),
+                  "Unable to read firmware version");
+    return std::string(buf);
+  }
+
+  const howler_device_info &info() const noexcept {
+    return *howler_get_device_info(dev_);
+  }
+
+  howler_device *get() const noexcept { return dev_; }
+
+ private:
+  howler_device *dev_;
+};
+
+/* Owns a howler_context and every device in it. */
+class Context {
+ public:
+  Context() : ctx_(nullptr) {
+    detail::check(howler_init(&ctx_), "Howler initialization failed");
+  }
+
+  explicit Context(const howler_init_options &options) : ctx_(nullptr) {
+    detail::check(howler_init_with_options(&ctx_, &options),
+                  "Howler initialization failed");
+  }
+
+  static Context virtual_devices(size_t nDevices) {
+    howler_context *ctx = nullptr;
+    detail::check(howler_init_virtual(&ctx, nDevices),
+                  "Unable to create virtual devices");
+    return Context(ctx);
+  }
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+  Context(Context &&other) noexcept : ctx_(std::exchange(other.ctx_, nullptr)) { }
+  Context &operator=(Context &&other) noexcept {
+    if(this != &other) {
+      howler_destroy(ctx_);
+      ctx_ = std::exchange(other.ctx_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Context() { howler_destroy(ctx_); }
+
+  size_t size() const noexcept { return howler_get_num_connected(ctx_); }
+
+  Device device(unsigned int index) {
+    howler_device *dev = howler_get_device(ctx_, index);
+    if(!dev) {
+      throw Error(HOWLER_ERROR_INVALID_PARAMS, "No such Howler device");
+    }
+    return Device(dev);
+  }
+
+  void handle_events(int timeout_ms) {
+    detail::check(howler_handle_events(ctx_, timeout_ms),
+                  "Unable to handle USB events");
+  }
+
+  howler_context *get() const noexcept { return ctx_; }
+
+ private:
+  explicit Context(howler_context *ctx) : ctx_(ctx) { }
+
+  howler_context *ctx_;
+};
+
+}  // namespace howler
+
+#endif  // __HOWLER_LIB_HPP__
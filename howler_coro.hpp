@@ -0,0 +1,349 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __HOWLER_LIB_CORO_HPP__
+#define __HOWLER_LIB_CORO_HPP__
+
+/* C++20 coroutine interface to the asynchronous command queue. Commands are
+ * submitted without blocking and the awaiting coroutine is handed to an
+ * Executor once the device has answered, so one thread can drive any number of
+ * outstanding commands by calling howler_handle_events:
+ *
+ *   howler::AsyncDevice dev(ctx.device(0).get(), executor);
+ *   std::string version = co_await dev.firmware_version();
+ *   co_await dev.set_led(howler::Button<7>{}, { { 255, 0, 0 } });
+ *   std::array<howler_led, HOWLER_NUM_LEDS> leds = co_await dev.read_leds();
+ */
+
+#include "howler.hpp"
+
+#include <array>
+#include <coroutine>
+#include <cstdio>
+#include <deque>
+
+namespace howler {
+
+/* Decides where a coroutine continues after its command completes. post is
+ * called from within howler_handle_events. */
+class Executor {
+ public:
+  virtual ~Executor() = default;
+  virtual void post(std::coroutine_handle<> handle) = 0;
+};
+
+/* Resumes coroutines right away on the thread handling USB events, from
+ * within the libusb callback of the command. Coroutines resumed this way must
+ * not call the synchronous howler_* functions, which would handle events
+ * from inside the event handler; use a QueueExecutor for those. */
+class InlineExecutor final : public Executor {
+ public:
+  void post(std::coroutine_handle<> handle) override { handle.resume(); }
+};
+
+inline InlineExecutor &inline_executor() {
+  static InlineExecutor executor;
+  return executor;
+}
+
+/* Holds coroutines until run is called, e.g. once per iteration of a main
+ * loop. */
+class QueueExecutor final : public Executor {
+ public:
+  void post(std::coroutine_handle<> handle) override { ready_.push_back(handle); }
+
+  /* Resumes every coroutine that was ready when it was called. Returns how
+   * many were resumed. */
+  size_t run() {
+    size_t n = ready_.size();
+    for(size_t i = 0; i < n; i++) {
+      std::coroutine_handle<> handle = ready_.front();
+      ready_.pop_front();
+      handle.resume();
+    }
+    return n;
+  }
+
+ private:
+  std::deque<std::coroutine_handle<>> ready_;
+};
+
+namespace detail {
+
+/* Shared by every command behind one co_await. The coroutine is posted once
+ * the last of them completes, with the first error seen. */
+struct AwaitState {
+  howler_device *dev;
+  Executor *executor;
+  std::coroutine_handle<> handle;
+  unsigned int remaining = 0;
+  int status = HOWLER_SUCCESS;
+
+  static void complete(howler_device *, int status, const unsigned char *,
+                       void *user_data) {
+    static_cast<AwaitState *>(user_data)->finish(status);
+  }
+
+  void finish(int err) {
+    if(err < 0 && status == HOWLER_SUCCESS) {
+      status = err;
+    }
+
+    if(--remaining == 0) {
+      executor->post(handle);
+    }
+  }
+
+  /* Brackets the submission of n commands in await_suspend. Commands that
+   * fail to submit can complete before the coroutine has suspended, so an
+   * extra count is held until end decides whether to suspend at all. */
+  void begin(unsigned int n) { remaining = n + 1; }
+
+  /* Accounts for commands that were never queued */
+  void fail(unsigned int unsent, int err) {
+    remaining -= unsent;
+    if(status == HOWLER_SUCCESS) {
+      status = err;
+    }
+  }
+
+  bool end() { return --remaining != 0; }
+
+  void check(const char *what) const { detail::check(status, what); }
+};
+
+}  // namespace detail
+
+class SetLedAwaitable {
+ public:
+  SetLedAwaitable(howler_device *dev, Executor *executor) {
+    state_.dev = dev;
+    state_.executor = executor;
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    state_.handle = handle;
+    state_.begin(1);
+
+    // The callback is attached to the last bank written, if any.
+    int n = howler_refresh_led_banks_async(state_.dev,
+                                           &detail::AwaitState::complete,
+                                           &state_);
+    if(n <= 0) {
+      state_.fail(1, n);
+    }
+    return state_.end();
+  }
+
+  void await_resume() const { state_.check("Unable to set LED"); }
+
+ private:
+  detail::AwaitState state_;
+};
+
+/* Returns the version cached in the device info when it is known, and
+ * caches the version it reads otherwise. */
+class FirmwareVersionAwaitable {
+ public:
+  FirmwareVersionAwaitable(howler_device *dev, Executor *executor) {
+    state_.dev = dev;
+    state_.executor = executor;
+  }
+
+  bool await_ready() const noexcept {
+    return state_.dev &&
+      (state_.dev->info.capabilities & HOWLER_CAPABILITY_FIRMWARE_VERSION);
+  }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    state_.handle = handle;
+
+    unsigned char cmd_buf[HOWLER_COMMAND_SIZE] = { CMD_HOWLER_ID, CMD_GET_FW_REV };
+    state_.begin(1);
+    int err = howler_submit_command(state_.dev, cmd_buf, 1, &complete, this);
+    if(err < 0) {
+      state_.fail(1, err);
+    }
+    return state_.end();
+  }
+
+  std::string await_resume() const {
+    state_.check("Unable to read firmware version");
+
+    // Formatted like howler_get_device_version.
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%u.%03u", state_.dev->info.firmware_major,
+             state_.dev->info.firmware_minor);
+    return std::string(buf);
+  }
+
+ private:
+  static void complete(howler_device *dev, int status,
+                       const unsigned char *response, void *user_data) {
+    FirmwareVersionAwaitable *self =
+      static_cast<FirmwareVersionAwaitable *>(user_data);
+
+    if(status == HOWLER_SUCCESS &&
+       (response[0] != CMD_HOWLER_ID || response[1] != CMD_GET_FW_REV)) {
+      status = HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+
+    if(status == HOWLER_SUCCESS) {
+      dev->info.firmware_major = response[2];
+      dev->info.firmware_minor = response[3];
+      dev->info.capabilities |= HOWLER_CAPABILITY_FIRMWARE_VERSION;
+    }
+    self->state_.finish(status);
+  }
+
+  detail::AwaitState state_;
+};
+
+/* Reads every LED back from the device with HOWLER_NUM_LEDS pipelined
+ * CMD_GET_RGB_LED commands. */
+class ReadLedsAwaitable {
+ public:
+  ReadLedsAwaitable(howler_device *dev, Executor *executor) {
+    state_.dev = dev;
+    state_.executor = executor;
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    state_.handle = handle;
+
+    state_.begin(HOWLER_NUM_LEDS);
+    if(howler_command_queue_space(state_.dev, HOWLER_PRIORITY_READBACK) <
+       HOWLER_NUM_LEDS) {
+      state_.fail(HOWLER_NUM_LEDS, HOWLER_ERROR_QUEUE_FULL);
+      return state_.end();
+    }
+
+    for(unsigned int i = 0; i < HOWLER_NUM_LEDS; i++) {
+      slots_[i].self = this;
+      slots_[i].index = i;
+
+      unsigned char cmd_buf[HOWLER_COMMAND_SIZE] = {
+        CMD_HOWLER_ID, CMD_GET_RGB_LED, (unsigned char)i
+      };
+
+      int err = howler_submit_command(state_.dev, cmd_buf, 1, &complete,
+                                      &slots_[i]);
+      if(err < 0) {
+        // The reads that made it into the queue still complete.
+        state_.fail(HOWLER_NUM_LEDS - i, err);
+        break;
+      }
+    }
+
+    return state_.end();
+  }
+
+  std::array<howler_led, HOWLER_NUM_LEDS> await_resume() const {
+    state_.check("Unable to read LEDs");
+    return leds_;
+  }
+
+ private:
+  struct Slot {
+    ReadLedsAwaitable *self;
+    unsigned int index;
+  };
+
+  static void complete(howler_device *, int status,
+                       const unsigned char *response, void *user_data) {
+    Slot *slot = static_cast<Slot *>(user_data);
+    if(status == HOWLER_SUCCESS &&
+       (response[0] != CMD_HOWLER_ID || response[1] != CMD_GET_RGB_LED)) {
+      status = HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+
+    if(status == HOWLER_SUCCESS) {
+      howler_led &led = slot->self->leds_[slot->index];
+      led.red = response[2];
+      led.green = response[3];
+      led.blue = response[4];
+    }
+    slot->self->state_.finish(status);
+  }
+
+  detail::AwaitState state_;
+  Slot slots_[HOWLER_NUM_LEDS];
+  std::array<howler_led, HOWLER_NUM_LEDS> leds_ = { };
+};
+
+/* Issues commands to one device of a Context through the asynchronous
+ * queue. The awaitables it returns must be awaited before the context is
+ * destroyed. */
+class AsyncDevice {
+ public:
+  explicit AsyncDevice(howler_device *dev,
+                       Executor &executor = inline_executor())
+    : dev_(dev), executor_(&executor) { }
+
+  AsyncDevice(const AsyncDevice &) = delete;
+  AsyncDevice &operator=(const AsyncDevice &) = delete;
+  AsyncDevice(AsyncDevice &&other) noexcept
+    : dev_(std::exchange(other.dev_, nullptr)), executor_(other.executor_) { }
+  AsyncDevice &operator=(AsyncDevice &&other) noexcept {
+    dev_ = std::exchange(other.dev_, nullptr);
+    executor_ = other.executor_;
+    return *this;
+  }
+
+  /* Updates the LED like Frame::set and sends the banks that changed */
+  template <typename Control>
+  SetLedAwaitable set_led(Control, howler_led led) noexcept {
+    dev_->logical_banks[Control::kBank[0]][Control::kSlot[0]] = led.red;
+    dev_->logical_banks[Control::kBank[1]][Control::kSlot[1]] = led.green;
+    dev_->logical_banks[Control::kBank[2]][Control::kSlot[2]] = led.blue;
+    return SetLedAwaitable(dev_, executor_);
+  }
+
+  /* Sends the whole frame, e.g. one built with Frame::set_all */
+  SetLedAwaitable set_leds(const howler_led_frame &frame) noexcept {
+    howler_led_frame_to_banks(dev_->logical_banks, frame);
+    return SetLedAwaitable(dev_, executor_);
+  }
+
+  ReadLedsAwaitable read_leds() noexcept {
+    return ReadLedsAwaitable(dev_, executor_);
+  }
+
+  FirmwareVersionAwaitable firmware_version() noexcept {
+    return FirmwareVersionAwaitable(dev_, executor_);
+  }
+
+  howler_device *get() const noexcept { return dev_; }
+
+ private:
+  howler_device *dev_;
+  Executor *executor_;
+};
+
+}  // namespace howler
+
+#endif  // __HOWLER_LIB_CORO_HPP__
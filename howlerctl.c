@@ -22,8 +22,12 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "howler.h"
 
@@ -55,9 +59,14 @@ static void print_usage() {
   printf("        help\n");
   printf("        get-firmware\n");
   printf("        get-led [CONTROL]\n");
+  printf("        dump-leds [json|binary] [hardware|fresh]\n");
+  printf("        set-group GROUPS NAME RED GREEN BLUE\n");
   printf("        set-led-channel CONTROL (red|green|blue) VALUE\n");
   printf("        set-led CONTROL RED GREEN BLUE\n");
   printf("        set-key INPUT KEY [MODIFIER[+MODIFIER[+...]]]\n");
+  printf("        save-defaults [leds|inputs]\n");
+  printf("        uinput-bridge [METRICS_ADDRESS]\n");
+  printf("        input-latency-test [RATE_HZ] [NUM_REPORTS]\n");
   printf("\n");
   printf("    CONTROL is a string conforming to one of the following:\n");
   printf("        J1 - J4: Joystick 1 to Joystick 4\n");
@@ -71,6 +80,16 @@ static void print_usage() {
   printf("    KEY is a character from a standard US keyboard\n");
   printf("        use the command 'howlerctl list-supported-keys' to print a list\n");
   printf("\n");
+  printf("    dump-leds prints every LED of every device. hardware gives the\n");
+  printf("        colors after color correction, and fresh reads them back\n");
+  printf("        from the devices. DEVICE is ignored.\n");
+  printf("\n");
+  printf("    GROUPS is a file with one LED group per line: a NAME followed by\n");
+  printf("        LEDs as DEVICE:CONTROL, e.g. p1 0:B1 0:B2 1:B1\n");
+  printf("\n");
+  printf("    METRICS_ADDRESS is where Prometheus metrics are served while\n");
+  printf("        bridging: a Unix socket path, or [HOST:]PORT on 127.0.0.1\n");
+  printf("\n");
   printf("    MODIFIER is any of the following:\n");
   printf("        LSHIFT, RSHIFT, LCTRL, RCTRL, LALT, RALT, LUI, RUI\n");
 }
@@ -553,6 +572,352 @@ static int set_key(howler_device *device, int cmd_idx, const char **argv, int ar
   return 0;
 }
 
+static int save_defaults(howler_device *device, int cmd_idx, const char **argv, int argc) {
+  unsigned int what = HOWLER_DEFAULTS_ALL;
+  const char *what_str = "LED colors and input mappings";
+  if((argc - cmd_idx) > 1) {
+    if(strcmp(argv[cmd_idx + 1], "leds") == 0) {
+      what = HOWLER_DEFAULTS_LEDS;
+      what_str = "LED colors";
+    } else if(strcmp(argv[cmd_idx + 1], "inputs") == 0) {
+      what = HOWLER_DEFAULTS_INPUTS;
+      what_str = "input mappings";
+    } else {
+      print_usage();
+      return -1;
+    }
+  }
+
+  int err = howler_save_defaults(device, what, 1);
+  if(err == HOWLER_ERROR_VERIFY_FAILED) {
+    fprintf(stderr, "The device did not confirm the new defaults\n");
+    return -1;
+  } else if(err < 0) {
+    fprintf(stderr, "INTERNAL ERROR: Unable to save defaults\n");
+    return -1;
+  }
+
+  printf("Saved the current %s as power-on defaults\n", what_str);
+  return 0;
+}
+
+static void print_json_string(const char *str) {
+  fputc('"', stdout);
+  for(; *str; str++) {
+    unsigned char c = (unsigned char)(*str);
+    if(c == '"' || c == '\\') {
+      fprintf(stdout, "\\%c", c);
+    } else if(c < 0x20) {
+      fprintf(stdout, "\\u%04x", c);
+    } else {
+      fputc(c, stdout);
+    }
+  }
+  fputc('"', stdout);
+}
+
+/* The binary dump is the magic "HWLS", a version byte of 1, the number of
+ * devices and of LEDs per device and a zero byte, followed by the red, green
+ * and blue bytes of every LED of every device in firmware order. */
+static void write_binary_leds(howler_led_frame *frames, int nFrames) {
+  unsigned char header[8] = { 'H', 'W', 'L', 'S', 1, 0, HOWLER_NUM_LEDS, 0 };
+  header[5] = (unsigned char)nFrames;
+  fwrite(header, 1, sizeof(header), stdout);
+
+  int i = 0;
+  for(; i < nFrames; i++) {
+    int led = 0;
+    for(; led < HOWLER_NUM_LEDS; led++) {
+      fwrite(frames[i][led].channels, 1, 3, stdout);
+    }
+  }
+}
+
+static void print_json_leds(howler_context *ctx, howler_led_frame *frames,
+                            int nFrames) {
+  fprintf(stdout, "{\"devices\":[");
+  int i = 0;
+  for(; i < nFrames; i++) {
+    const howler_device_info *info =
+      howler_get_device_info(howler_get_device(ctx, i));
+
+    fprintf(stdout, "%s\n{\"index\":%d,\"bus\":", (i > 0)? "," : "", i);
+    print_json_string(info->bus_path);
+    fprintf(stdout, ",\"serial\":");
+    print_json_string(info->serial);
+    fprintf(stdout, ",\"leds\":[");
+
+    int led = 0;
+    for(; led < HOWLER_NUM_LEDS; led++) {
+      fprintf(stdout, "%s[%d,%d,%d]", (led > 0)? "," : "",
+              frames[i][led].red, frames[i][led].green, frames[i][led].blue);
+    }
+    fprintf(stdout, "]}");
+  }
+  fprintf(stdout, "\n]}\n");
+}
+
+static int dump_leds(howler_context *ctx, int cmd_idx, const char **argv, int argc) {
+  int binary = 0;
+  unsigned int flags = 0;
+
+  int i = cmd_idx + 1;
+  for(; i < argc; i++) {
+    if(strcmp(argv[i], "json") == 0) {
+      binary = 0;
+    } else if(strcmp(argv[i], "binary") == 0) {
+      binary = 1;
+    } else if(strcmp(argv[i], "hardware") == 0) {
+      flags |= HOWLER_LED_STATE_HARDWARE;
+    } else if(strcmp(argv[i], "fresh") == 0) {
+      flags |= HOWLER_LED_STATE_FRESH;
+    } else {
+      print_usage();
+      return -1;
+    }
+  }
+
+  size_t nDevices = howler_get_num_connected(ctx);
+  howler_led_frame *frames = malloc(nDevices * sizeof(howler_led_frame));
+  if(!frames) {
+    return -1;
+  }
+
+  int nFrames = howler_get_led_state(frames, nDevices, ctx, flags);
+  if(nFrames < 0) {
+    fprintf(stderr, "INTERNAL ERROR: Unable to read LEDs\n");
+    free(frames);
+    return -1;
+  }
+
+  if(binary) {
+    write_binary_leds(frames, nFrames);
+  } else {
+    print_json_leds(ctx, frames, nFrames);
+  }
+
+  free(frames);
+  return 0;
+}
+
+#define MAX_LED_GROUPS 64
+
+static int set_group(howler_context *ctx, int cmd_idx, const char **argv, int argc) {
+  if((argc - cmd_idx) != 6) {
+    print_usage();
+    return -1;
+  }
+
+  howler_led color;
+  if((parse_byte(&(color.red), argv[cmd_idx + 3], "Red LED") < 0) ||
+     (parse_byte(&(color.green), argv[cmd_idx + 4], "Green LED") < 0) ||
+     (parse_byte(&(color.blue), argv[cmd_idx + 5], "Blue LED") < 0)) {
+    return -1;
+  }
+
+  static howler_led_group groups[MAX_LED_GROUPS];
+  int nGroups = howler_led_groups_load(groups, MAX_LED_GROUPS, ctx,
+                                       argv[cmd_idx + 1]);
+  if(nGroups < 0) {
+    return -1;
+  }
+
+  const howler_led_group *group =
+    howler_find_led_group(groups, nGroups, argv[cmd_idx + 2]);
+  if(!group) {
+    fprintf(stderr, "No LED group named %s\n", argv[cmd_idx + 2]);
+    return -1;
+  }
+
+  int err = howler_set_led_group(ctx, group, color);
+
+  // The bank writes are queued, so wait for them before exiting.
+  size_t i = 0;
+  for(; i < group->nPlans; i++) {
+    howler_device *dev = howler_get_device(ctx, group->plans[i].device);
+    if(howler_flush_commands(dev) < 0) {
+      err = -1;
+    }
+  }
+
+  if(err < 0) {
+    fprintf(stderr, "INTERNAL ERROR: Unable to set LED group\n");
+    return -1;
+  }
+  return 0;
+}
+
+static volatile sig_atomic_t gQuit = 0;
+
+static void handle_quit_signal(int sig) {
+  (void)sig;
+  gQuit = 1;
+}
+
+static int run_uinput_bridge(howler_context *ctx, const char *metrics_address) {
+  howler_uinput_bridge *bridge;
+  if(howler_uinput_bridge_create(&bridge, ctx) < 0) {
+    fprintf(stderr, "Unable to create uinput devices. Is the uinput module loaded?\n");
+    return -1;
+  }
+
+  howler_metrics_exporter *exporter = NULL;
+  if(metrics_address &&
+     howler_metrics_start(&exporter, ctx, metrics_address) < 0) {
+    fprintf(stderr, "Unable to serve metrics on %s\n", metrics_address);
+    howler_uinput_bridge_destroy(bridge);
+    return -1;
+  }
+
+  int err = howler_start_input(ctx);
+  if(err < 0) {
+    fprintf(stderr, "INTERNAL ERROR: Unable to listen for input reports\n");
+    howler_metrics_stop(exporter);
+    howler_uinput_bridge_destroy(bridge);
+    return -1;
+  }
+
+  signal(SIGINT, handle_quit_signal);
+  signal(SIGTERM, handle_quit_signal);
+
+  fprintf(stdout, "Bridging %d device%s to uinput. Press Ctrl-C to stop.\n",
+          (int)howler_get_num_connected(ctx),
+          (howler_get_num_connected(ctx) > 1)? "s" : "");
+
+  while(!gQuit && !ctx->exitFlag) {
+    if(howler_handle_events(ctx, 100) < 0) {
+      err = -1;
+      break;
+    }
+  }
+
+  howler_stop_input(ctx);
+
+  howler_uinput_stats stats;
+  howler_uinput_bridge_get_stats(bridge, &stats);
+  fprintf(stdout, "Reports: %llu, events: %llu, write errors: %llu\n",
+          stats.reports, stats.events, stats.write_errors);
+  if(stats.reports) {
+    fprintf(stdout, "Latency (us): min %.1f, avg %.1f, max %.1f\n",
+            stats.latency_min_ns / 1000.0,
+            stats.latency_total_ns / (1000.0 * stats.reports),
+            stats.latency_max_ns / 1000.0);
+  }
+
+  howler_metrics_stop(exporter);
+  howler_uinput_bridge_destroy(bridge);
+  return err;
+}
+
+static void print_latency_histogram(const howler_latency_histogram *hist) {
+  if(!hist->count) {
+    fprintf(stdout, "No samples\n");
+    return;
+  }
+
+  fprintf(stdout, "Samples: %llu\n", hist->count);
+  fprintf(stdout, "Latency (us): min %.2f, avg %.2f, max %.2f\n",
+          hist->min_ns / 1000.0,
+          hist->total_ns / (1000.0 * hist->count),
+          hist->max_ns / 1000.0);
+  fprintf(stdout, "Percentiles (us): p50 < %.2f, p90 < %.2f, p99 < %.2f, p99.9 < %.2f\n",
+          howler_latency_histogram_percentile(hist, 50.0) / 1000.0,
+          howler_latency_histogram_percentile(hist, 90.0) / 1000.0,
+          howler_latency_histogram_percentile(hist, 99.0) / 1000.0,
+          howler_latency_histogram_percentile(hist, 99.9) / 1000.0);
+
+  int i = 0;
+  for(; i < HOWLER_LATENCY_BUCKETS; i++) {
+    if(!hist->buckets[i]) {
+      continue;
+    }
+
+    int width = (int)((60 * hist->buckets[i]) / hist->count);
+    fprintf(stdout, "  < %10.2f us: %8llu ", (1ULL << (i + 1)) / 1000.0,
+            hist->buckets[i]);
+    for(; width > 0; width--) {
+      fputc('#', stdout);
+    }
+    fputc('\n', stdout);
+  }
+}
+
+static void count_input_event(const howler_input_event *event, void *user_data) {
+  (void)event;
+  unsigned long long *nEvents = (unsigned long long *)user_data;
+  (*nEvents)++;
+}
+
+/* Drives a virtual device at a fixed report rate. Every report is considered
+ * to arrive at its scheduled time, so the measured latency includes both the
+ * scheduling jitter of this process and the dispatch through the library. */
+static int run_input_latency_test(int cmd_idx, const char **argv, int argc) {
+  unsigned long rate = 1000;
+  unsigned long nReports = 10000;
+  if((argc - cmd_idx) > 1 && sscanf(argv[cmd_idx + 1], "%lu", &rate) != 1) {
+    print_usage();
+    return -1;
+  }
+
+  if((argc - cmd_idx) > 2 && sscanf(argv[cmd_idx + 2], "%lu", &nReports) != 1) {
+    print_usage();
+    return -1;
+  }
+
+  if(!rate || rate > 1000000) {
+    fprintf(stderr, "Expected a rate in the range 1-1000000 Hz\n");
+    return -1;
+  }
+
+  howler_context *ctx;
+  if(howler_init_virtual(&ctx, 1) < 0) {
+    fprintf(stderr, "INTERNAL ERROR: Unable to create virtual device\n");
+    return -1;
+  }
+
+  unsigned long long nEvents = 0;
+  howler_set_input_event_callback(ctx, count_input_event, &nEvents);
+
+  fprintf(stdout, "Sending %lu reports at %lu Hz...\n", nReports, rate);
+
+  howler_device *dev = howler_get_device(ctx, 0);
+  uint64_t period_ns = 1000000000ULL / rate;
+  uint64_t deadline = howler_get_time_ns() + period_ns;
+
+  unsigned long i = 0;
+  for(; i < nReports; i++, deadline += period_ns) {
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    int err;
+    while((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR);
+    if(err != 0) {
+      fprintf(stderr, "ERROR: Unable to sleep: %s\n", strerror(err));
+      howler_destroy(ctx);
+      return -1;
+    }
+
+    // Alternate between pressing and releasing each button in turn.
+    unsigned char report[24];
+    memset(report, 0, sizeof(report));
+    if((i & 1) == 0) {
+      int ipt = eHowlerInput_Button1 + (i / 2) % HOWLER_NUM_BUTTONS;
+      report[ipt / 8] = 1 << (ipt % 8);
+    }
+
+    howler_inject_input_report(dev, report, deadline);
+  }
+
+  fprintf(stdout, "Dispatched %llu events\n", nEvents);
+
+  howler_latency_histogram hist;
+  howler_get_input_latency(ctx, &hist);
+  print_latency_histogram(&hist);
+
+  howler_destroy(ctx);
+  return 0;
+}
+
 int main(int argc, const char **argv) {
   int exitCode = 0;
 
@@ -579,6 +944,12 @@ int main(int argc, const char **argv) {
     exit(1);
   }
 
+  // Commands that don't need any hardware.
+  if(strncmp(argv[(device_idx_specified)? 2 : 1], "input-latency-test", 18) == 0) {
+    int cmd_idx = (device_idx_specified)? 2 : 1;
+    exit((run_input_latency_test(cmd_idx, argv, argc) < 0)? 1 : 0);
+  }
+
   howler_context *ctx;
   if(howler_init(&ctx) < 0) {
     fprintf(stderr, "Howler initialization failed.\n");
@@ -620,6 +991,22 @@ int main(int argc, const char **argv) {
     get_firmware(device, versionBuf, 256);
     printf("Firmware version: %s\n", versionBuf);
     goto done;
+  } else if(strncmp(cmd, "uinput-bridge", 13) == 0) {
+    const char *metrics_address = (cmd_idx + 1 < argc)? argv[cmd_idx + 1] : NULL;
+    if(run_uinput_bridge(ctx, metrics_address) < 0) {
+      exitCode = 1;
+    }
+    goto done;
+  } else if(strncmp(cmd, "dump-leds", 9) == 0) {
+    if(dump_leds(ctx, cmd_idx, argv, argc) < 0) {
+      exitCode = 1;
+    }
+    goto done;
+  } else if(strncmp(cmd, "set-group", 9) == 0) {
+    if(set_group(ctx, cmd_idx, argv, argc) < 0) {
+      exitCode = 1;
+    }
+    goto done;
   } else if(strncmp(cmd, "list-supported-keys", 19) == 0) {
     cmdFn = list_supported_keys;
   } else if(strncmp(cmd, "get-led", 7) == 0) {
@@ -630,6 +1017,8 @@ int main(int argc, const char **argv) {
     cmdFn = &set_led;
   } else if(strncmp(cmd, "set-key", 7) == 0) {
     cmdFn = &set_key;
+  } else if(strncmp(cmd, "save-defaults", 13) == 0) {
+    cmdFn = &save_defaults;
   } else {
     print_usage();
     exitCode = 1;
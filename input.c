@@ -0,0 +1,192 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <time.h>
+
+uint64_t howler_get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+howler_input_mask howler_parse_input_report(const unsigned char *report) {
+  howler_input_mask state = 0;
+  int i = 0;
+  for(; i < 6; i++) {
+    state |= ((howler_input_mask)report[i]) << (8 * i);
+  }
+  return state & HOWLER_INPUT_MASK_ALL;
+}
+
+void howler_set_input_callbacks(howler_context *ctx,
+                                howler_button_callback key_down,
+                                howler_button_callback key_up,
+                                void *user_data) {
+  if(!ctx) { return; }
+  ctx->key_down_callback = key_down;
+  ctx->key_up_callback = key_up;
+  ctx->callback_user_data = user_data;
+}
+
+void howler_set_input_event_callback(howler_context *ctx,
+                                     howler_input_event_callback callback,
+                                     void *user_data) {
+  if(!ctx) { return; }
+  ctx->input_event_callback = callback;
+  ctx->input_event_user_data = user_data;
+}
+
+void howler_set_report_callback(howler_context *ctx,
+                                howler_report_callback callback,
+                                void *user_data) {
+  if(!ctx) { return; }
+  ctx->report_callback = callback;
+  ctx->report_user_data = user_data;
+}
+
+static void dispatch_input_state(howler_device *dev, howler_input_mask state,
+                                 uint64_t arrival_ns) {
+  howler_context *ctx = dev->ctx;
+
+  howler_input_mask changed = state ^ dev->input_state;
+  dev->input_state = state;
+
+  // Most reports are repeats of the previous state...
+  if(!changed) {
+    return;
+  }
+
+  // Reactions go first so that their LED writes are on the way before the
+  // application hears about the edges.
+  howler_run_reactions(dev, changed, state);
+
+  HOWLER_SPAN_BEGIN(span);
+  if(ctx->report_callback) {
+    ctx->report_callback(dev, changed, state, arrival_ns, ctx->report_user_data);
+  }
+
+  // Walk only the bits that changed.
+  while(changed) {
+    howler_input_event event;
+    event.device = dev;
+    event.input = __builtin_ctzll(changed);
+    event.pressed = (state >> event.input) & 1;
+    event.sequence = dev->input_sequence++;
+    event.arrival_ns = arrival_ns;
+    event.dispatch_ns = howler_get_time_ns();
+    changed &= changed - 1;
+
+    howler_latency_histogram_add(&(ctx->input_latency),
+                                 event.dispatch_ns - arrival_ns);
+
+    if(ctx->input_event_callback) {
+      ctx->input_event_callback(&event, ctx->input_event_user_data);
+    }
+
+    if(event.pressed) {
+      if(ctx->key_down_callback) {
+        ctx->key_down_callback(event.input, ctx->callback_user_data);
+      }
+    } else if(ctx->key_up_callback) {
+      ctx->key_up_callback(event.input, ctx->callback_user_data);
+    }
+  }
+  HOWLER_SPAN_END(span, "input_dispatch", -1);
+}
+
+static int debounce_enabled(const howler_device *dev) {
+  return (dev->debounce.time_mask | dev->debounce.integrator_mask) != 0;
+}
+
+void howler_process_input_report(howler_device *dev,
+                                 const unsigned char *report,
+                                 uint64_t arrival_ns) {
+  howler_input_mask raw = howler_parse_input_report(report);
+  dev->transfer_stats.input_reports++;
+  dev->input_raw = raw;
+  dev->input_raw_arrival_ns = arrival_ns;
+
+  howler_input_mask state = raw;
+  if(debounce_enabled(dev)) {
+    state = howler_debounce_update(dev, raw, arrival_ns);
+  }
+
+  dispatch_input_state(dev, state, arrival_ns);
+
+  // The report span covers the time since the transfer completed.
+  HOWLER_SPAN_END(arrival_ns, "input_report", (int)(dev - dev->ctx->devices));
+}
+
+void howler_process_input_timers(howler_context *ctx, uint64_t now_ns) {
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    howler_device *dev = &(ctx->devices[i]);
+    uint64_t deadline = howler_debounce_deadline(dev);
+    if(!deadline || now_ns < deadline) {
+      continue;
+    }
+
+    // Edges that complete on a timer are still attributed to the report that
+    // carried them.
+    howler_input_mask state = howler_debounce_update(dev, dev->input_raw, now_ns);
+    dispatch_input_state(dev, state, dev->input_raw_arrival_ns);
+  }
+}
+
+uint64_t howler_next_input_deadline(const howler_context *ctx) {
+  uint64_t next = 0;
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    uint64_t deadline = howler_debounce_deadline(&(ctx->devices[i]));
+    if(deadline && (!next || deadline < next)) {
+      next = deadline;
+    }
+  }
+  return next;
+}
+
+int howler_inject_input_report(howler_device *dev,
+                               const unsigned char *report,
+                               uint64_t arrival_ns) {
+  if(!dev || !report) { return HOWLER_ERROR_INVALID_PTR; }
+
+  if(!arrival_ns) {
+    arrival_ns = howler_get_time_ns();
+  }
+
+  howler_process_input_report(dev, report, arrival_ns);
+  return HOWLER_SUCCESS;
+}
+
+void howler_get_input_latency(howler_context *ctx,
+                              howler_latency_histogram *out) {
+  if(!ctx || !out) { return; }
+  *out = ctx->input_latency;
+}
+
+void howler_reset_input_latency(howler_context *ctx) {
+  if(!ctx) { return; }
+  howler_latency_histogram_reset(&(ctx->input_latency));
+}
@@ -0,0 +1,243 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+#include "howler_led_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HOWLER_USE_NEON
+#endif
+
+/* Both a frame and the six banks are 96 bytes and every channel of every LED
+ * occupies exactly one slot in the banks, so converting between them is a
+ * fixed permutation of the bytes. */
+#define NUM_CHANNELS (HOWLER_NUM_LEDS * 3)
+typedef char frame_is_dense[(sizeof(howler_led_frame) == NUM_CHANNELS)? 1 : -1];
+typedef char banks_are_dense[(6 * sizeof(howler_led_bank) == NUM_CHANNELS)? 1 : -1];
+
+typedef struct {
+  // Byte j of the output comes from byte perm[j] of the input.
+  const unsigned char *perm;
+
+#if defined(__SSSE3__)
+  // For every 16 byte output register and every 16 byte input register, the
+  // shuffle that moves the bytes between them.
+  const unsigned char (*shuffle)[6][16];
+#endif
+} permutation;
+
+#if defined(__SSSE3__)
+static const unsigned char kFrameToBanksShuffle[6][6][16] =
+  HOWLER_FRAME_TO_BANKS_SHUFFLE_INIT;
+static const unsigned char kBanksToFrameShuffle[6][6][16] =
+  HOWLER_BANKS_TO_FRAME_SHUFFLE_INIT;
+
+static const permutation kFrameToBanks = { howler_frame_to_banks, kFrameToBanksShuffle };
+static const permutation kBanksToFrame = { howler_banks_to_frame, kBanksToFrameShuffle };
+#else
+static const permutation kFrameToBanks = { howler_frame_to_banks };
+static const permutation kBanksToFrame = { howler_banks_to_frame };
+#endif
+
+static void permute(unsigned char *out, const unsigned char *in,
+                    const permutation *p) {
+#if defined(__SSSE3__)
+  __m128i src[6];
+  int c = 0;
+  for(; c < 6; c++) {
+    src[c] = _mm_loadu_si128((const __m128i *)(in + 16 * c));
+  }
+
+  int k = 0;
+  for(; k < 6; k++) {
+    __m128i acc = _mm_setzero_si128();
+    for(c = 0; c < 6; c++) {
+      __m128i shuffle = _mm_loadu_si128((const __m128i *)(p->shuffle[k][c]));
+      acc = _mm_or_si128(acc, _mm_shuffle_epi8(src[c], shuffle));
+    }
+    _mm_storeu_si128((__m128i *)(out + 16 * k), acc);
+  }
+#elif defined(HOWLER_USE_NEON)
+  // tbl looks up the first 64 bytes and leaves zeroes for the rest, then tbx
+  // fills in the lanes that come from the last 32 bytes.
+  uint8x16x4_t lo = { { vld1q_u8(in), vld1q_u8(in + 16),
+                        vld1q_u8(in + 32), vld1q_u8(in + 48) } };
+  uint8x16x2_t hi = { { vld1q_u8(in + 64), vld1q_u8(in + 80) } };
+  const uint8x16_t offset = vdupq_n_u8(64);
+
+  int k = 0;
+  for(; k < 6; k++) {
+    uint8x16_t idx = vld1q_u8(p->perm + 16 * k);
+    uint8x16_t v = vqtbl4q_u8(lo, idx);
+    v = vqtbx2q_u8(v, hi, vsubq_u8(idx, offset));
+    vst1q_u8(out + 16 * k, v);
+  }
+#else
+  int j = 0;
+  for(; j < NUM_CHANNELS; j++) {
+    out[j] = in[p->perm[j]];
+  }
+#endif
+}
+
+void howler_led_frame_to_banks(howler_led_bank *banks, const howler_led *frame) {
+  permute((unsigned char *)banks, (const unsigned char *)frame, &kFrameToBanks);
+}
+
+void howler_led_banks_to_frame(howler_led *frame, const howler_led_bank *banks) {
+  permute((unsigned char *)frame, (const unsigned char *)banks, &kBanksToFrame);
+}
+
+unsigned int howler_led_banks_diff(const howler_led_bank *a,
+                                   const howler_led_bank *b) {
+  unsigned int mask = 0;
+  int k = 0;
+  for(; k < 6; k++) {
+#if defined(__SSE2__)
+    __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a[k]),
+                                _mm_loadu_si128((const __m128i *)b[k]));
+    mask |= (unsigned int)(_mm_movemask_epi8(eq) != 0xFFFF) << k;
+#elif defined(HOWLER_USE_NEON)
+    uint8x16_t eq = vceqq_u8(vld1q_u8(a[k]), vld1q_u8(b[k]));
+    mask |= (unsigned int)(vminvq_u8(eq) != 0xFF) << k;
+#else
+    mask |= (unsigned int)(memcmp(a[k], b[k], sizeof(howler_led_bank)) != 0) << k;
+#endif
+  }
+  return mask;
+}
+
+int howler_led_banks_uniform_scale(const howler_led_bank *next,
+                                   const howler_led_bank *base) {
+  const howler_led_channel *n = (const howler_led_channel *)next;
+  const howler_led_channel *b = (const howler_led_channel *)base;
+
+  // The brightest channel of base gives the most precise estimate.
+  int brightest = 0;
+  int i = 1;
+  for(; i < NUM_CHANNELS; i++) {
+    if(b[i] > b[brightest]) {
+      brightest = i;
+    }
+  }
+
+  if(b[brightest] == 0) {
+    return -1;
+  }
+
+  int level = (n[brightest] * 255 + b[brightest] / 2) / b[brightest];
+  if(level > 255) {
+    return -1;
+  }
+
+  for(i = 0; i < NUM_CHANNELS; i++) {
+    int expected = (b[i] * level + 127) / 255;
+    int error = n[i] - expected;
+    if(error < -1 || error > 1) {
+      return -1;
+    }
+  }
+
+  return level;
+}
+
+unsigned int howler_led_frame_update_banks(howler_led_bank *banks,
+                                           const howler_led *frame) {
+  howler_led_bank next[6];
+  howler_led_frame_to_banks(next, frame);
+
+  unsigned int changed = howler_led_banks_diff(next, banks);
+  if(changed) {
+    memcpy(banks, next, sizeof(next));
+  }
+  return changed;
+}
+
+int howler_set_led_frame(howler_device *dev, const howler_led *frame) {
+  if(!dev || !frame) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  // Repainting the same scene needs neither color correction nor USB
+  // traffic, unless the banks it left behind never reached the device.
+  unsigned int changed = howler_led_frame_update_banks(dev->logical_banks, frame);
+  if(!changed && !dev->failed_banks && !dev->marked_banks) {
+    dev->frame_pacer.identical++;
+    dev->frame_pacer.banks_avoided += 6;
+    return HOWLER_SUCCESS;
+  }
+
+  // The refresh sends every bank that was marked but not committed too.
+  HOWLER_SPAN_BEGIN(span);
+  dev->marked_banks = 0;
+  int err = howler_refresh_led_banks(dev);
+  HOWLER_SPAN_END(span, "led_frame_commit", -1);
+  return err;
+}
+
+int howler_get_led_frame(howler_led *frame, const howler_device *dev) {
+  if(!dev || !frame) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  howler_led_banks_to_frame(frame, (const howler_led_bank *)dev->logical_banks);
+  return HOWLER_SUCCESS;
+}
+
+int howler_parse_led_name(const char *name) {
+  // The whole name has to be a letter followed by digits, so strtoul must
+  // start on a digit, which rules out whitespace and signs, and consume the
+  // rest.
+  if(!name || name[0] == '\0' || name[1] < '0' || name[1] > '9') {
+    return -1;
+  }
+
+  char *end = NULL;
+  unsigned long index = strtoul(name + 1, &end, 10);
+  if(*end != '\0') {
+    return -1;
+  }
+
+  if((name[0] == 'J' || name[0] == 'j') && index >= 1 &&
+     index <= HOWLER_NUM_JOYSTICKS) {
+    return HOWLER_LED_INDEX_JOYSTICK(index);
+  } else if((name[0] == 'B' || name[0] == 'b') && index >= 1 &&
+            index <= HOWLER_NUM_BUTTONS) {
+    return HOWLER_LED_INDEX_BUTTON(index);
+  } else if((name[0] == 'H' || name[0] == 'h') && index >= 1 &&
+            index <= HOWLER_NUM_HIGH_POWER_LEDS) {
+    return HOWLER_LED_INDEX_HIGH_POWER(index);
+  }
+
+  return -1;
+}
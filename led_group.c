@@ -0,0 +1,276 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************************************************
+ *
+ * Plans
+ *
+ ******************************************************************************/
+
+static howler_led_group_plan *find_plan(howler_led_group *group,
+                                        unsigned int device) {
+  size_t i = 0;
+  for(; i < group->nPlans; i++) {
+    if(group->plans[i].device == device) {
+      return &(group->plans[i]);
+    }
+  }
+
+  if(group->nPlans == HOWLER_MAX_GROUP_DEVICES) {
+    return NULL;
+  }
+
+  howler_led_group_plan *plan = &(group->plans[group->nPlans++]);
+  memset(plan, 0, sizeof(*plan));
+  plan->device = device;
+  return plan;
+}
+
+int howler_led_group_init(howler_led_group *group, const char *name,
+                          const howler_context *ctx,
+                          const howler_led_ref *leds, size_t nLeds) {
+  if(!group || !name || !ctx || (!leds && nLeds)) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  if(strlen(name) >= HOWLER_LED_GROUP_NAME_SIZE) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  memset(group, 0, sizeof(*group));
+  strcpy(group->name, name);
+
+  size_t i = 0;
+  for(; i < nLeds; i++) {
+    if(leds[i].device >= ctx->nDevices || leds[i].led >= HOWLER_NUM_LEDS) {
+      return HOWLER_ERROR_INVALID_PARAMS;
+    }
+
+    howler_led_group_plan *plan = find_plan(group, leds[i].device);
+    if(!plan) {
+      fprintf(stderr, "ERROR: LED group %s spans more than %d devices\n",
+              name, HOWLER_MAX_GROUP_DEVICES);
+      return HOWLER_ERROR_INVALID_PARAMS;
+    }
+
+    int c = 0;
+    for(; c < 3; c++) {
+      const unsigned char *loc = howler_led_to_bank[leds[i].led][c];
+      plan->slots[loc[0]] |= (uint16_t)(1 << loc[1]);
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+/*******************************************************************************
+ *
+ * Setters
+ *
+ ******************************************************************************/
+
+int howler_led_group_write(howler_context *ctx, const howler_led_group *group,
+                           const howler_led_channel *values,
+                           unsigned int bank_mask) {
+  size_t i = 0;
+  for(; i < group->nPlans; i++) {
+    const howler_led_group_plan *plan = &(group->plans[i]);
+    if(plan->device >= ctx->nDevices) {
+      return HOWLER_ERROR_INVALID_PARAMS;
+    }
+
+    howler_device *dev = &(ctx->devices[plan->device]);
+    int bank = 0;
+    for(; bank < 6; bank++) {
+      unsigned int slots = (bank_mask & (1 << bank))? plan->slots[bank] : 0;
+      howler_led_channel value = values[bank / 2];
+      while(slots) {
+        int slot = __builtin_ctz(slots);
+        slots &= slots - 1;
+
+        if(dev->logical_banks[bank][slot] != value) {
+          dev->logical_banks[bank][slot] = value;
+          dev->marked_banks |= 1 << bank;
+        }
+      }
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+static int set_group_banks(howler_context *ctx, const howler_led_group *group,
+                           const howler_led_channel *values,
+                           unsigned int bank_mask) {
+  if(!ctx || !group) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  int err = howler_led_group_write(ctx, group, values, bank_mask);
+  if(err < 0) {
+    return err;
+  }
+
+  // Every device is committed before any error is returned, so that the
+  // group never ends up half set.
+  size_t i = 0;
+  for(; i < group->nPlans; i++) {
+    int dev_err =
+      howler_commit_marked_banks(&(ctx->devices[group->plans[i].device]));
+    if(dev_err < 0 && err == HOWLER_SUCCESS) {
+      err = dev_err;
+    }
+  }
+
+  return err;
+}
+
+int howler_set_led_group(howler_context *ctx, const howler_led_group *group,
+                         howler_led color) {
+  return set_group_banks(ctx, group, color.channels, 0x3F);
+}
+
+int howler_set_led_group_channel(howler_context *ctx,
+                                 const howler_led_group *group,
+                                 howler_led_channel_name channel,
+                                 howler_led_channel value) {
+  if((unsigned int)channel > HOWLER_LED_CHANNEL_BLUE) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  howler_led_channel values[3] = { value, value, value };
+  return set_group_banks(ctx, group, values, 0x3 << (2 * channel));
+}
+
+/*******************************************************************************
+ *
+ * Group files
+ *
+ ******************************************************************************/
+
+static int parse_led_ref(howler_led_ref *ref, const char *str) {
+  ref->device = 0;
+  const char *colon = strchr(str, ':');
+  if(colon) {
+    char *end = NULL;
+    unsigned long device = strtoul(str, &end, 10);
+    if(end != colon || colon == str) {
+      return -1;
+    }
+    ref->device = (unsigned int)device;
+    str = colon + 1;
+  }
+
+  int led = howler_parse_led_name(str);
+  if(led < 0) {
+    return -1;
+  }
+
+  ref->led = (unsigned char)led;
+  return 0;
+}
+
+int howler_led_groups_load(howler_led_group *groups, size_t maxGroups,
+                           const howler_context *ctx, const char *path) {
+  if(!groups || !ctx || !path) { return HOWLER_ERROR_INVALID_PTR; }
+
+  FILE *fp = fopen(path, "r");
+  if(!fp) {
+    fprintf(stderr, "ERROR: Unable to open LED groups %s\n", path);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  int err = HOWLER_SUCCESS;
+  size_t nGroups = 0;
+  int line_number = 0;
+  char line[1024];
+  while(fgets(line, sizeof(line), fp)) {
+    line_number++;
+
+    char *comment = strchr(line, '#');
+    if(comment) {
+      *comment = '\0';
+    }
+
+    char *save = NULL;
+    const char *name = strtok_r(line, " \t\r\n", &save);
+    if(!name) {
+      continue;
+    }
+
+    if(nGroups == maxGroups) {
+      fprintf(stderr, "ERROR: %s:%d: more than %lu groups\n", path,
+              line_number, (unsigned long)maxGroups);
+      err = HOWLER_ERROR_INVALID_PARAMS;
+      break;
+    }
+
+    howler_led_ref leds[HOWLER_MAX_GROUP_DEVICES * HOWLER_NUM_LEDS];
+    size_t nLeds = 0;
+    const char *token = NULL;
+    while((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+      if(nLeds == sizeof(leds) / sizeof(leds[0]) ||
+         parse_led_ref(&(leds[nLeds]), token) < 0) {
+        err = HOWLER_ERROR_INVALID_PARAMS;
+        break;
+      }
+      nLeds++;
+    }
+
+    if(err == HOWLER_SUCCESS) {
+      err = howler_led_group_init(&(groups[nGroups]), name, ctx, leds, nLeds);
+    }
+
+    if(err < 0) {
+      fprintf(stderr, "ERROR: %s:%d: expected a group name of fewer than %d "
+              "characters followed by LEDs as DEVICE:CONTROL (J#, B#, H#) on "
+              "connected devices\n", path, line_number,
+              HOWLER_LED_GROUP_NAME_SIZE);
+      break;
+    }
+    nGroups++;
+  }
+
+  fclose(fp);
+  return (err < 0)? err : (int)nGroups;
+}
+
+const howler_led_group *howler_find_led_group(const howler_led_group *groups,
+                                              size_t nGroups,
+                                              const char *name) {
+  if(!groups || !name) { return NULL; }
+
+  size_t i = 0;
+  for(; i < nGroups; i++) {
+    if(strcmp(groups[i].name, name) == 0) {
+      return &(groups[i]);
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,224 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+
+/* Weight of each new round trip in the moving average, as a shift. */
+static const int kRttSmoothingShift = 3;
+
+static int pump_device(howler_device *dev, uint64_t now_ns);
+
+/* How long to hold off a frame that could not be sent: about a frame's worth
+ * of time, or a millisecond before the first frame went out. */
+static uint64_t retry_delay(const howler_frame_pacer *pacer) {
+  return pacer->rtt_ewma_ns? pacer->rtt_ewma_ns : 1000000ULL;
+}
+
+static void frame_sent(howler_device *dev, int status,
+                       const unsigned char *response, void *user_data) {
+  (void)response;
+  (void)user_data;
+
+  howler_frame_pacer *pacer = &(dev->frame_pacer);
+  uint64_t now = howler_get_time_ns();
+  pacer->in_flight = 0;
+
+  // Banks that failed to go out are resent with the next frame, which is
+  // left to the next pump so that a device that keeps failing is not
+  // retried from within its own callbacks.
+  if(status < 0) {
+    pacer->errors++;
+    pacer->pending = 1;
+    pacer->next_send_ns = now + retry_delay(pacer);
+    return;
+  }
+
+  if(dev->failed_banks) {
+    pacer->pending = 1;
+  }
+
+  uint64_t rtt = now - pacer->send_start_ns;
+  if(pacer->rtt_ewma_ns == 0) {
+    pacer->rtt_ewma_ns = rtt;
+    pacer->rtt_min_ns = rtt;
+    pacer->rtt_max_ns = rtt;
+  } else {
+    pacer->rtt_ewma_ns +=
+      ((int64_t)rtt - (int64_t)pacer->rtt_ewma_ns) >> kRttSmoothingShift;
+    if(rtt < pacer->rtt_min_ns) { pacer->rtt_min_ns = rtt; }
+    if(rtt > pacer->rtt_max_ns) { pacer->rtt_max_ns = rtt; }
+  }
+
+  pump_device(dev, now);
+}
+
+static int pump_device(howler_device *dev, uint64_t now_ns) {
+  howler_frame_pacer *pacer = &(dev->frame_pacer);
+  if(!pacer->pending || pacer->in_flight || now_ns < pacer->next_send_ns) {
+    return HOWLER_SUCCESS;
+  }
+
+  howler_led_channel level = dev->brightness.sent;
+  int n = howler_refresh_led_banks_async(dev, frame_sent, NULL);
+  if(n == HOWLER_ERROR_QUEUE_FULL) {
+    // Other commands are hogging the queue; give them about a frame's worth
+    // of time before trying again.
+    pacer->next_send_ns = now_ns + retry_delay(pacer);
+    return HOWLER_SUCCESS;
+  }
+
+  pacer->pending = 0;
+  if(n < 0) {
+    pacer->errors++;
+    return n;
+  }
+
+  // A frame is a fade when it only took a change of brightness.
+  int banks = n - (dev->brightness.sent != level);
+  pacer->banks_avoided += 6 - banks;
+  if(n == 0) {
+    pacer->unchanged++;
+    return HOWLER_SUCCESS;
+  }
+
+  if(banks == 0) {
+    pacer->fades++;
+  }
+
+  pacer->sent++;
+  pacer->in_flight = 1;
+  pacer->send_start_ns = now_ns;
+  pacer->next_send_ns = now_ns + pacer->min_interval_ns;
+  return HOWLER_SUCCESS;
+}
+
+int howler_commit_led_frame(howler_device *dev, const howler_led *frame) {
+  if(!dev || !frame) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  return howler_commit_led_banks(
+    dev, howler_led_frame_update_banks(dev->logical_banks, frame));
+}
+
+int howler_commit_led_banks(howler_device *dev, unsigned int changed) {
+  howler_frame_pacer *pacer = &(dev->frame_pacer);
+  pacer->committed++;
+
+  // A repeated frame changes nothing, whether or not the previous one has
+  // gone out yet, so it neither replaces a pending frame nor wakes anything.
+  if(!changed) {
+    pacer->identical++;
+    pacer->static_commits++;
+    if(!pacer->pending && !pacer->in_flight) {
+      pacer->banks_avoided += 6;
+    }
+    return HOWLER_SUCCESS;
+  }
+
+  HOWLER_SPAN_BEGIN(span);
+  pacer->static_commits = 0;
+  if(pacer->pending) {
+    pacer->dropped++;
+  }
+  pacer->pending = 1;
+
+  int err = pump_device(dev, howler_get_time_ns());
+  HOWLER_SPAN_END(span, "led_frame_commit", -1);
+  return err;
+}
+
+int howler_commit_marked_banks(howler_device *dev) {
+  unsigned int changed = dev->marked_banks;
+  dev->marked_banks = 0;
+  return howler_commit_led_banks(dev, changed);
+}
+
+void howler_set_led_frame_interval(howler_device *dev, uint64_t interval_ns) {
+  if(!dev) { return; }
+  howler_frame_pacer *pacer = &(dev->frame_pacer);
+  pacer->min_interval_ns = interval_ns;
+  pacer->next_send_ns = pacer->send_start_ns + interval_ns;
+}
+
+void howler_get_led_frame_stats(const howler_device *dev,
+                                howler_led_frame_stats *stats) {
+  const howler_frame_pacer *pacer = &(dev->frame_pacer);
+  stats->committed = pacer->committed;
+  stats->sent = pacer->sent;
+  stats->dropped = pacer->dropped;
+  stats->unchanged = pacer->unchanged;
+  stats->identical = pacer->identical;
+  stats->banks_avoided = pacer->banks_avoided;
+  stats->errors = pacer->errors;
+  stats->fades = pacer->fades;
+  stats->quiescent = !pacer->pending && !pacer->in_flight &&
+                     (pacer->committed == 0 ||
+                      pacer->static_commits >= HOWLER_LED_QUIESCENT_COMMITS);
+  stats->rtt_avg_ns = pacer->rtt_ewma_ns;
+  stats->rtt_min_ns = pacer->rtt_min_ns;
+  stats->rtt_max_ns = pacer->rtt_max_ns;
+}
+
+void howler_pump_led_frames(howler_context *ctx, uint64_t now_ns) {
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    pump_device(&(ctx->devices[i]), now_ns);
+  }
+}
+
+uint64_t howler_next_led_frame_deadline(const howler_context *ctx) {
+  uint64_t deadline = 0;
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    const howler_frame_pacer *pacer = &(ctx->devices[i].frame_pacer);
+    if(!pacer->pending || pacer->in_flight) {
+      continue;
+    }
+
+    if(!deadline || pacer->next_send_ns < deadline) {
+      deadline = pacer->next_send_ns;
+    }
+  }
+
+  return deadline;
+}
+
+int howler_led_frames_quiescent(const howler_context *ctx) {
+  if(ctx->timeline) {
+    return 0;
+  }
+
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    const howler_frame_pacer *pacer = &(ctx->devices[i].frame_pacer);
+    if(pacer->pending || pacer->in_flight ||
+       (pacer->committed > 0 &&
+        pacer->static_commits < HOWLER_LED_QUIESCENT_COMMITS)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
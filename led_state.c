@@ -0,0 +1,180 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <string.h>
+
+// Devices whose reads are queued together. Each one takes up to
+// HOWLER_NUM_LEDS entries of its READBACK queue.
+#define READBACK_BATCH 8
+
+typedef struct {
+  howler_led *frame;
+  int errors;
+} readback_state;
+
+/* A read of one LED, which lands in the frame of its device. */
+typedef struct {
+  readback_state *state;
+  unsigned char index;
+} pending_read;
+
+static void led_read(howler_device *dev, int status,
+                     const unsigned char *response, void *user_data) {
+  (void)dev;
+  pending_read *p = (pending_read *)user_data;
+  if(status < 0 || !response ||
+     response[0] != CMD_HOWLER_ID || response[1] != CMD_GET_RGB_LED) {
+    p->state->errors++;
+    return;
+  }
+
+  howler_led *led = &(p->state->frame[p->index]);
+  led->red = response[2];
+  led->green = response[3];
+  led->blue = response[4];
+}
+
+static int queue_led_reads(howler_device *dev, pending_read *pending) {
+  unsigned char i = 0;
+  for(; i < HOWLER_NUM_LEDS; i++) {
+    // HOWLER_COMMAND_QUEUE_DEPTH can be smaller than the number of LEDs, and
+    // reads queued by someone else take room too, so the reads go in as the
+    // class makes room for them.
+    int err = howler_wait_for_queue_space(dev, HOWLER_PRIORITY_READBACK);
+    if(err < 0) {
+      return err;
+    }
+
+    unsigned char cmd_buf[HOWLER_COMMAND_SIZE];
+    memset(cmd_buf, 0, sizeof(cmd_buf));
+    cmd_buf[0] = CMD_HOWLER_ID;
+    cmd_buf[1] = CMD_GET_RGB_LED;
+    cmd_buf[2] = i;
+
+    err = howler_submit_command_with_priority(dev, HOWLER_PRIORITY_READBACK,
+                                              cmd_buf, 1, led_read,
+                                              &(pending[i]));
+    if(err < 0) {
+      return err;
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+/* Reads back the LEDs of up to READBACK_BATCH devices, starting with first,
+ * into frames. */
+static int read_batch(howler_led_frame *frames, howler_context *ctx,
+                      size_t first, size_t count) {
+  readback_state states[READBACK_BATCH];
+  pending_read pending[READBACK_BATCH][HOWLER_NUM_LEDS];
+
+  int err = HOWLER_SUCCESS;
+  size_t i = 0;
+  for(; i < count && err == HOWLER_SUCCESS; i++) {
+    howler_device *dev = &(ctx->devices[first + i]);
+    states[i].frame = frames[i];
+    states[i].errors = 0;
+    if(!dev->usb_handle) {
+      continue;
+    }
+
+    unsigned char led = 0;
+    for(; led < HOWLER_NUM_LEDS; led++) {
+      pending[i][led].state = &(states[i]);
+      pending[i][led].index = led;
+    }
+
+    err = queue_led_reads(dev, pending[i]);
+  }
+
+  // The callbacks point into this stack frame, so everything that was queued
+  // has to finish before returning, even after an error. The devices are
+  // served together while the first one is waited on, and a device whose
+  // flush fails has the rest of its reads cancelled through the callbacks.
+  size_t queued = i;
+  int flush_err = HOWLER_SUCCESS;
+  for(i = 0; i < queued; i++) {
+    howler_device *dev = &(ctx->devices[first + i]);
+    if(dev->usb_handle && howler_flush_commands(dev) < 0) {
+      howler_cancel_commands(dev);
+      flush_err = HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+  }
+
+  if(err < 0) {
+    return err;
+  }
+
+  if(flush_err < 0) {
+    return flush_err;
+  }
+
+  for(i = 0; i < count; i++) {
+    howler_device *dev = &(ctx->devices[first + i]);
+    if(states[i].errors) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+
+    if(dev->usb_handle) {
+      howler_led_frame_to_banks(dev->led_banks, frames[i]);
+    } else {
+      howler_led_banks_to_frame(frames[i],
+                                (const howler_led_bank *)dev->led_banks);
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+int howler_get_led_state(howler_led_frame *frames, size_t nFrames,
+                         howler_context *ctx, unsigned int flags) {
+  if(!frames || !ctx) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  size_t n = (ctx->nDevices < nFrames)? ctx->nDevices : nFrames;
+  size_t i = 0;
+  if(flags & HOWLER_LED_STATE_FRESH) {
+    for(; i < n; i += READBACK_BATCH) {
+      size_t count = (n - i < READBACK_BATCH)? n - i : READBACK_BATCH;
+      int err = read_batch(frames + i, ctx, i, count);
+      if(err < 0) {
+        return err;
+      }
+    }
+    return (int)n;
+  }
+
+  for(; i < n; i++) {
+    const howler_device *dev = &(ctx->devices[i]);
+    const howler_led_bank *banks = (flags & HOWLER_LED_STATE_HARDWARE)?
+      (const howler_led_bank *)dev->led_banks :
+      (const howler_led_bank *)dev->logical_banks;
+    howler_led_banks_to_frame(frames[i], banks);
+  }
+
+  return (int)n;
+}
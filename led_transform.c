@@ -0,0 +1,156 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static void build_curves(howler_led_transform *xf) {
+  int identity = 1;
+  int c = 0;
+  for(; c < 3; c++) {
+    float white = xf->white_balance.channels[c] / 255.0f;
+    int v = 0;
+    for(; v < 256; v++) {
+      float x = powf(v / 255.0f, xf->gamma) * white;
+      int out = (int)(x * 255.0f + 0.5f);
+      out = (out > 255)? 255 : out;
+      xf->curve[c][v] = (howler_led_channel)out;
+      identity = identity && (out == v);
+    }
+  }
+
+  const howler_led_channel *max_level = (const howler_led_channel *)xf->max_level;
+  int i = 0;
+  for(; i < 6 * 16; i++) {
+    identity = identity && (max_level[i] == 255);
+  }
+
+  xf->identity = identity;
+}
+
+void howler_led_transform_init(howler_led_transform *xf) {
+  xf->gamma = 1.0f;
+  xf->white_balance.red = 255;
+  xf->white_balance.green = 255;
+  xf->white_balance.blue = 255;
+  memset(xf->max_level, 255, sizeof(xf->max_level));
+  build_curves(xf);
+}
+
+howler_led_channel howler_led_transform_channel(const howler_led_transform *xf,
+                                                unsigned char bank,
+                                                unsigned char led,
+                                                howler_led_channel value) {
+  if(xf->identity) {
+    return value;
+  }
+
+  unsigned int curved = xf->curve[bank / 2][value];
+  return (howler_led_channel)((curved * (xf->max_level[bank][led] + 1)) >> 8);
+}
+
+void howler_led_transform_apply(const howler_led_transform *xf,
+                                howler_led_bank *out,
+                                const howler_led_bank *in) {
+  if(xf->identity) {
+    memcpy(out, in, 6 * sizeof(howler_led_bank));
+    return;
+  }
+
+  // Each color channel covers two consecutive banks, i.e. 32 values.
+  const howler_led_channel *src = (const howler_led_channel *)in;
+  howler_led_channel curved[6 * 16];
+  int i = 0;
+  for(; i < 6 * 16; i++) {
+    curved[i] = xf->curve[i / 32][src[i]];
+  }
+
+  const howler_led_channel *max_level = (const howler_led_channel *)xf->max_level;
+  howler_led_channel *dst = (howler_led_channel *)out;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  for(i = 0; i < 6 * 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(curved + i));
+    __m128i m = _mm_loadu_si128((const __m128i *)(max_level + i));
+
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero),
+                                 _mm_add_epi16(_mm_unpacklo_epi8(m, zero), one));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero),
+                                 _mm_add_epi16(_mm_unpackhi_epi8(m, zero), one));
+
+    lo = _mm_srli_epi16(lo, 8);
+    hi = _mm_srli_epi16(hi, 8);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+#else
+  for(i = 0; i < 6 * 16; i++) {
+    dst[i] = (howler_led_channel)((curved[i] * (max_level[i] + 1)) >> 8);
+  }
+#endif
+}
+
+int howler_set_gamma(howler_device *dev, float gamma) {
+  if(!dev) { return HOWLER_ERROR_INVALID_PTR; }
+  if(!(gamma > 0.0f)) { return HOWLER_ERROR_INVALID_PARAMS; }
+
+  dev->led_transform.gamma = gamma;
+  build_curves(&(dev->led_transform));
+  return howler_refresh_led_banks(dev);
+}
+
+int howler_set_white_balance(howler_device *dev, howler_led white) {
+  if(!dev) { return HOWLER_ERROR_INVALID_PTR; }
+
+  dev->led_transform.white_balance = white;
+  build_curves(&(dev->led_transform));
+  return howler_refresh_led_banks(dev);
+}
+
+int howler_set_high_power_led_max_brightness(howler_device *dev,
+                                             unsigned char index,
+                                             howler_led_channel level) {
+  if(!dev) { return HOWLER_ERROR_INVALID_PTR; }
+
+  int high_power_index = (int)index - 1;
+  if(high_power_index < 0 || high_power_index >= HOWLER_NUM_HIGH_POWER_LEDS) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  int k = 0;
+  for(; k < 3; k++) {
+    unsigned char bank = howler_hp_led_to_bank[high_power_index][k][0];
+    unsigned char led = howler_hp_led_to_bank[high_power_index][k][1];
+    dev->led_transform.max_level[bank][led] = level;
+  }
+
+  build_curves(&(dev->led_transform));
+  return howler_refresh_led_banks(dev);
+}
@@ -0,0 +1,142 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HOWLER_STATIC_ALLOCATION
+// The arena used by contexts that are not given one.
+static howler_arena gArena;
+#endif
+
+howler_arena *howler_acquire_arena(howler_arena *arena) {
+#ifdef HOWLER_STATIC_ALLOCATION
+  if(!arena) {
+    arena = &gArena;
+  }
+
+  if(arena->in_use) {
+    return NULL;
+  }
+
+  memset(arena, 0, sizeof(*arena));
+  arena->in_use = 1;
+  return arena;
+#else
+  (void)arena;
+  return NULL;
+#endif
+}
+
+void howler_release_arena(howler_arena *arena) {
+#ifdef HOWLER_STATIC_ALLOCATION
+  if(arena) {
+    arena->in_use = 0;
+  }
+#else
+  (void)arena;
+#endif
+}
+
+howler_device *howler_alloc_devices(howler_arena *arena, size_t *nDevices) {
+#ifdef HOWLER_STATIC_ALLOCATION
+  if(*nDevices > HOWLER_MAX_DEVICES) {
+    *nDevices = HOWLER_MAX_DEVICES;
+  }
+
+  howler_device *devices = arena->devices;
+#else
+  // One spare so that a context without devices still gets a block.
+  (void)arena;
+  howler_device *devices = malloc((*nDevices + 1) * sizeof(howler_device));
+  if(!devices) {
+    return NULL;
+  }
+#endif
+
+  memset(devices, 0, *nDevices * sizeof(howler_device));
+  return devices;
+}
+
+void howler_free_devices(howler_arena *arena, howler_device *devices) {
+#ifdef HOWLER_STATIC_ALLOCATION
+  (void)arena;
+  (void)devices;
+#else
+  (void)arena;
+  free(devices);
+#endif
+}
+
+howler_context *howler_alloc_context(howler_arena *arena) {
+#ifdef HOWLER_STATIC_ALLOCATION
+  howler_context *ctx = &(arena->context);
+#else
+  howler_context *ctx = malloc(sizeof(howler_context));
+  if(!ctx) {
+    return NULL;
+  }
+#endif
+
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->arena = arena;
+  return ctx;
+}
+
+void howler_free_context(howler_context *ctx) {
+  howler_arena *arena = ctx->arena;
+  howler_free_devices(arena, ctx->devices);
+#ifdef HOWLER_STATIC_ALLOCATION
+  howler_release_arena(arena);
+#else
+  free(ctx);
+#endif
+}
+
+int howler_get_memory_usage(const howler_context *ctx,
+                            howler_memory_usage *usage) {
+  if(!ctx || !usage) { return HOWLER_ERROR_INVALID_PTR; }
+
+  memset(usage, 0, sizeof(*usage));
+  usage->context_bytes = sizeof(howler_context);
+#ifdef HOWLER_STATIC_ALLOCATION
+  usage->device_bytes = HOWLER_MAX_DEVICES * sizeof(howler_device);
+  usage->total_bytes = sizeof(howler_arena);
+#else
+  // Including the spare device of howler_alloc_devices.
+  usage->device_bytes = (ctx->nDevices + 1) * sizeof(howler_device);
+  usage->total_bytes = usage->context_bytes + usage->device_bytes;
+#endif
+
+  size_t i = 0;
+  for(; i < ctx->nDevices; i++) {
+    const howler_device *dev = &(ctx->devices[i]);
+    usage->transfers += (dev->input_transfer != NULL);
+    usage->transfers += (dev->commands.out_transfer != NULL);
+    usage->transfers += (dev->commands.in_transfer != NULL);
+  }
+
+  return HOWLER_SUCCESS;
+}
@@ -0,0 +1,505 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The exporter thread reads counters that the event loop keeps updating
+// without synchronization. Each one is read whole, and no more is promised.
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/*******************************************************************************
+ *
+ * Serialization
+ *
+ ******************************************************************************/
+
+typedef struct {
+  int fd;
+  char buf[4096];
+  size_t len;
+  int error;
+} metrics_writer;
+
+static void flush_writer(metrics_writer *w) {
+  size_t sent = 0;
+  while(!w->error && sent < w->len) {
+    // A scraper that hangs up must not raise SIGPIPE in the application.
+    ssize_t n = send(w->fd, w->buf + sent, w->len - sent, MSG_NOSIGNAL);
+    if(n < 0 && errno == ENOTSOCK) {
+      n = write(w->fd, w->buf + sent, w->len - sent);
+    }
+
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if(n <= 0) {
+      w->error = 1;
+    } else {
+      sent += (size_t)n;
+    }
+  }
+  w->len = 0;
+}
+
+static void emit(metrics_writer *w, const char *fmt, ...) {
+  int attempt = 0;
+  for(; attempt < 2 && !w->error; attempt++) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = sizeof(w->buf) - w->len;
+    int n = vsnprintf(w->buf + w->len, room, fmt, args);
+    va_end(args);
+
+    if(n >= 0 && (size_t)n < room) {
+      w->len += (size_t)n;
+      return;
+    }
+
+    // Lines are far shorter than the buffer, so one that doesn't fit goes
+    // in once the buffer is flushed.
+    flush_writer(w);
+  }
+}
+
+static void emit_family(metrics_writer *w, const char *name, const char *type,
+                        const char *help) {
+  emit(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void emit_histogram(metrics_writer *w, const char *name,
+                           const char *labels,
+                           const howler_latency_histogram *hist) {
+  const char *sep = labels[0]? "," : "";
+
+  // Bucket i of the histogram ends at 2^(i + 1) ns, and the last bucket is
+  // unbounded.
+  unsigned long long count = 0;
+  int i = 0;
+  for(; i < HOWLER_LATENCY_BUCKETS - 1; i++) {
+    count += LOAD(hist->buckets[i]);
+    emit(w, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep,
+         (double)(2ULL << i) * 1e-9, count);
+  }
+
+  count += LOAD(hist->buckets[HOWLER_LATENCY_BUCKETS - 1]);
+  emit(w, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, count);
+  const char *lbrace = labels[0]? "{" : "";
+  const char *rbrace = labels[0]? "}" : "";
+  emit(w, "%s_sum%s%s%s %.9f\n", name, lbrace, labels, rbrace,
+       (double)LOAD(hist->total_ns) * 1e-9);
+  emit(w, "%s_count%s%s%s %llu\n", name, lbrace, labels, rbrace, count);
+}
+
+typedef struct {
+  const char *name;
+  const char *help;
+  size_t offset;
+} device_counter;
+
+static const device_counter kDeviceCounters[] = {
+  { "howler_usb_transfers_total",
+    "Interrupt transfers with the device.",
+    offsetof(howler_device, transfer_stats.transfers) },
+  { "howler_usb_transfer_failures_total",
+    "Interrupt transfers with the device that failed.",
+    offsetof(howler_device, transfer_stats.failures) },
+  { "howler_input_reports_total",
+    "Input reports received from the device.",
+    offsetof(howler_device, transfer_stats.input_reports) },
+  { "howler_led_frames_committed_total",
+    "LED frames committed by the application.",
+    offsetof(howler_device, frame_pacer.committed) },
+  { "howler_led_frames_sent_total",
+    "LED frames sent to the device.",
+    offsetof(howler_device, frame_pacer.sent) },
+  { "howler_led_frames_dropped_total",
+    "LED frames replaced by a later frame before they were sent.",
+    offsetof(howler_device, frame_pacer.dropped) },
+  { "howler_led_frames_unchanged_total",
+    "LED frames skipped because the hardware already showed them.",
+    offsetof(howler_device, frame_pacer.unchanged) },
+  { "howler_led_frames_identical_total",
+    "LED frames skipped because they repeated the previous frame.",
+    offsetof(howler_device, frame_pacer.identical) },
+  { "howler_led_frame_errors_total",
+    "LED frames whose bank writes failed.",
+    offsetof(howler_device, frame_pacer.errors) },
+  { "howler_led_fades_total",
+    "LED frames sent as a single global brightness change.",
+    offsetof(howler_device, frame_pacer.fades) },
+  { "howler_led_bank_writes_avoided_total",
+    "LED bank writes skipped because the bank did not change.",
+    offsetof(howler_device, frame_pacer.banks_avoided) },
+};
+
+static const char *kPriorityNames[HOWLER_NUM_COMMAND_PRIORITIES] = {
+  "control", "input", "led", "readback"
+};
+
+static void device_labels(const howler_context *ctx, size_t index,
+                          char *dst, size_t dst_size) {
+  snprintf(dst, dst_size, "device=\"%u\",bus=\"%s\"", (unsigned int)index,
+           ctx->devices[index].info.bus_path);
+}
+
+int howler_metrics_write(const howler_context *ctx, int fd) {
+  if(!ctx) { return HOWLER_ERROR_INVALID_PTR; }
+
+  metrics_writer w;
+  w.fd = fd;
+  w.len = 0;
+  w.error = 0;
+
+  char labels[HOWLER_BUS_PATH_SIZE + 32];
+
+  emit_family(&w, "howler_devices", "gauge", "Devices opened by the library.");
+  emit(&w, "howler_devices %u\n", (unsigned int)ctx->nDevices);
+
+  emit_family(&w, "howler_init_duration_seconds", "gauge",
+              "Time taken by howler_init to open the devices.");
+  emit(&w, "howler_init_duration_seconds %.9f\n", (double)ctx->init_ns * 1e-9);
+
+  size_t c = 0;
+  for(; c < sizeof(kDeviceCounters) / sizeof(kDeviceCounters[0]); c++) {
+    emit_family(&w, kDeviceCounters[c].name, "counter", kDeviceCounters[c].help);
+
+    size_t i = 0;
+    for(; i < ctx->nDevices; i++) {
+      const unsigned long long *value = (const unsigned long long *)
+        ((const char *)&(ctx->devices[i]) + kDeviceCounters[c].offset);
+      device_labels(ctx, i, labels, sizeof(labels));
+      emit(&w, "%s{%s} %llu\n", kDeviceCounters[c].name, labels, LOAD(*value));
+    }
+  }
+
+  emit_family(&w, "howler_led_frame_rtt_seconds", "gauge",
+              "Smoothed time for the bank writes of an LED frame to complete.");
+  size_t i = 0;
+  for(; i < ctx->nDevices; i++) {
+    device_labels(ctx, i, labels, sizeof(labels));
+    emit(&w, "howler_led_frame_rtt_seconds{%s} %.9f\n", labels,
+         (double)LOAD(ctx->devices[i].frame_pacer.rtt_ewma_ns) * 1e-9);
+  }
+
+  emit_family(&w, "howler_command_queue_length", "gauge",
+              "Queued commands waiting to be sent, by priority class.");
+  for(i = 0; i < ctx->nDevices; i++) {
+    device_labels(ctx, i, labels, sizeof(labels));
+    int p = 0;
+    for(; p < HOWLER_NUM_COMMAND_PRIORITIES; p++) {
+      emit(&w, "howler_command_queue_length{%s,priority=\"%s\"} %u\n", labels,
+           kPriorityNames[p],
+           LOAD(ctx->devices[i].commands.rings[p].count));
+    }
+  }
+
+  emit_family(&w, "howler_command_latency_seconds", "histogram",
+              "Time from the start of a queued command to its completion.");
+  for(i = 0; i < ctx->nDevices; i++) {
+    device_labels(ctx, i, labels, sizeof(labels));
+    emit_histogram(&w, "howler_command_latency_seconds", labels,
+                   &(ctx->devices[i].transfer_stats.command_latency));
+  }
+
+  emit_family(&w, "howler_input_dispatch_latency_seconds", "histogram",
+              "Time from the arrival of an input report to the dispatch of "
+              "each of its events.");
+  emit_histogram(&w, "howler_input_dispatch_latency_seconds", "",
+                 &(ctx->input_latency));
+
+  flush_writer(&w);
+  return w.error? HOWLER_ERROR_SOCKET_ERROR : HOWLER_SUCCESS;
+}
+
+/*******************************************************************************
+ *
+ * Exporter
+ *
+ ******************************************************************************/
+
+struct howler_metrics_exporter {
+  howler_context *ctx;
+  int listen_fd;
+  int wake_fds[2];
+  pthread_t thread;
+  char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+};
+
+#ifdef HOWLER_STATIC_ALLOCATION
+// A static allocation build has room for a single exporter.
+static howler_metrics_exporter gExporter;
+static int gExporterInUse = 0;
+#endif
+
+static int listen_unix(howler_metrics_exporter *exporter, const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+  strcpy(addr.sun_path, path);
+
+  // A socket left behind by an earlier run would make bind fail.
+  struct stat st;
+  if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return HOWLER_ERROR_SOCKET_ERROR;
+  }
+
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "ERROR: Unable to bind metrics socket %s: %s\n", path,
+            strerror(errno));
+    close(fd);
+    return HOWLER_ERROR_SOCKET_ERROR;
+  }
+
+  strcpy(exporter->unix_path, path);
+  exporter->listen_fd = fd;
+  return HOWLER_SUCCESS;
+}
+
+static int listen_tcp(howler_metrics_exporter *exporter, const char *address) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  const char *port = address;
+  const char *colon = strrchr(address, ':');
+  if(colon) {
+    char host[INET_ADDRSTRLEN];
+    size_t len = (size_t)(colon - address);
+    if(len >= sizeof(host)) {
+      return HOWLER_ERROR_INVALID_PARAMS;
+    }
+    memcpy(host, address, len);
+    host[len] = '\0';
+
+    if(len > 0 && inet_pton(AF_INET, host, &(addr.sin_addr)) != 1) {
+      return HOWLER_ERROR_INVALID_PARAMS;
+    }
+    port = colon + 1;
+  }
+
+  char *end = NULL;
+  unsigned long port_num = strtoul(port, &end, 10);
+  if(!port[0] || *end || port_num == 0 || port_num > 65535) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+  addr.sin_port = htons((unsigned short)port_num);
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return HOWLER_ERROR_SOCKET_ERROR;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "ERROR: Unable to bind metrics socket %s: %s\n", address,
+            strerror(errno));
+    close(fd);
+    return HOWLER_ERROR_SOCKET_ERROR;
+  }
+
+  exporter->listen_fd = fd;
+  return HOWLER_SUCCESS;
+}
+
+static void serve_scrape(howler_metrics_exporter *exporter, int fd) {
+  // Neither a slow nor a stuck scraper may hold up the next one for long.
+  struct timeval timeout;
+  timeout.tv_sec = 1;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // Every request gets the metrics, so the request only needs to be read up
+  // to the end of its headers.
+  char request[1024];
+  size_t len = 0;
+  while(len < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      break;
+    }
+
+    len += (size_t)n;
+    request[len] = '\0';
+    if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+      break;
+    }
+  }
+
+  static const char kHeader[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+  if(send(fd, kHeader, sizeof(kHeader) - 1, MSG_NOSIGNAL) ==
+     (ssize_t)(sizeof(kHeader) - 1)) {
+    howler_metrics_write(exporter->ctx, fd);
+  }
+}
+
+static void *exporter_thread(void *arg) {
+  howler_metrics_exporter *exporter = (howler_metrics_exporter *)arg;
+
+  struct pollfd fds[2];
+  fds[0].fd = exporter->listen_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = exporter->wake_fds[0];
+  fds[1].events = POLLIN;
+
+  for(;;) {
+    fds[0].revents = 0;
+    fds[1].revents = 0;
+    if(poll(fds, 2, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if(fds[1].revents) {
+      break;
+    }
+
+    if(fds[0].revents & POLLIN) {
+      int fd = accept(exporter->listen_fd, NULL, NULL);
+      if(fd >= 0) {
+        serve_scrape(exporter, fd);
+        close(fd);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static void free_exporter(howler_metrics_exporter *exporter) {
+  if(exporter->listen_fd >= 0) {
+    close(exporter->listen_fd);
+  }
+  if(exporter->unix_path[0]) {
+    unlink(exporter->unix_path);
+  }
+  if(exporter->wake_fds[0] >= 0) {
+    close(exporter->wake_fds[0]);
+    close(exporter->wake_fds[1]);
+  }
+
+#ifdef HOWLER_STATIC_ALLOCATION
+  gExporterInUse = 0;
+#else
+  free(exporter);
+#endif
+}
+
+int howler_metrics_start(howler_metrics_exporter **exporter_ptr,
+                         howler_context *ctx,
+                         const char *address) {
+  if(!exporter_ptr || !ctx || !address) { return HOWLER_ERROR_INVALID_PTR; }
+  *exporter_ptr = NULL;
+
+#ifdef HOWLER_STATIC_ALLOCATION
+  if(gExporterInUse) {
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+  gExporterInUse = 1;
+  howler_metrics_exporter *exporter = &gExporter;
+#else
+  howler_metrics_exporter *exporter = malloc(sizeof(howler_metrics_exporter));
+  if(!exporter) {
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+#endif
+
+  memset(exporter, 0, sizeof(*exporter));
+  exporter->ctx = ctx;
+  exporter->listen_fd = -1;
+  exporter->wake_fds[0] = -1;
+  exporter->wake_fds[1] = -1;
+
+  int err = HOWLER_SUCCESS;
+  if(strncmp(address, "unix:", 5) == 0) {
+    err = listen_unix(exporter, address + 5);
+  } else if(address[0] == '/' || address[0] == '.') {
+    err = listen_unix(exporter, address);
+  } else {
+    err = listen_tcp(exporter, address);
+  }
+
+  if(err == HOWLER_SUCCESS &&
+     (listen(exporter->listen_fd, 8) < 0 ||
+      pipe(exporter->wake_fds) < 0)) {
+    err = HOWLER_ERROR_SOCKET_ERROR;
+  }
+
+  if(err == HOWLER_SUCCESS &&
+     pthread_create(&(exporter->thread), NULL, exporter_thread, exporter)) {
+    err = HOWLER_ERROR_SOCKET_ERROR;
+  }
+
+  if(err < 0) {
+    free_exporter(exporter);
+    return err;
+  }
+
+  *exporter_ptr = exporter;
+  return HOWLER_SUCCESS;
+}
+
+void howler_metrics_stop(howler_metrics_exporter *exporter) {
+  if(!exporter) { return; }
+
+  char wake = 0;
+  while(write(exporter->wake_fds[1], &wake, 1) < 0 && errno == EINTR);
+  pthread_join(exporter->thread, NULL);
+  free_exporter(exporter);
+}
@@ -0,0 +1,220 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*******************************************************************************
+ *
+ * Rules
+ *
+ ******************************************************************************/
+
+static int check_reaction(const howler_context *ctx,
+                          const howler_reaction *rule) {
+  if(rule->device >= ctx->nDevices) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  if((unsigned int)rule->input > eHowlerInput_LAST) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  const howler_reaction_action actions[2] = { rule->on_press, rule->on_release };
+  int i = 0;
+  for(; i < 2; i++) {
+    switch(actions[i]) {
+    case HOWLER_REACTION_NONE:
+    case HOWLER_REACTION_STOP_TIMELINE:
+      break;
+
+    case HOWLER_REACTION_SET_COLOR:
+    case HOWLER_REACTION_RESTORE:
+      if(!rule->group) {
+        return HOWLER_ERROR_INVALID_PTR;
+      }
+
+      if(rule->group->nPlans > HOWLER_MAX_GROUP_DEVICES) {
+        return HOWLER_ERROR_INVALID_PARAMS;
+      }
+
+      size_t j = 0;
+      for(; j < rule->group->nPlans; j++) {
+        if(rule->group->plans[j].device >= ctx->nDevices) {
+          return HOWLER_ERROR_INVALID_PARAMS;
+        }
+      }
+      break;
+
+    case HOWLER_REACTION_PLAY_TIMELINE:
+      if(!rule->timeline) {
+        return HOWLER_ERROR_INVALID_PTR;
+      }
+      break;
+
+    default:
+      return HOWLER_ERROR_INVALID_PARAMS;
+    }
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+int howler_set_reactions(howler_context *ctx, howler_reaction *rules,
+                         size_t nRules) {
+  if(!ctx || (nRules && !rules)) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  // Check every rule before installing any, so that a bad table leaves the
+  // previous one running.
+  size_t i = 0;
+  for(; i < nRules; i++) {
+    int err = check_reaction(ctx, &(rules[i]));
+    if(err < 0) {
+      fprintf(stderr, "ERROR: Invalid reaction rule %lu\n", (unsigned long)i);
+      return err;
+    }
+  }
+
+  howler_input_mask inputs = 0;
+  for(i = 0; i < nRules; i++) {
+    rules[i].saved = 0;
+    inputs |= (howler_input_mask)1 << rules[i].input;
+  }
+
+  ctx->reactions = nRules? rules : NULL;
+  ctx->nReactions = nRules;
+  ctx->reaction_inputs = inputs;
+  return HOWLER_SUCCESS;
+}
+
+/*******************************************************************************
+ *
+ * Actions
+ *
+ ******************************************************************************/
+
+static void save_group(howler_context *ctx, howler_reaction *rule) {
+  size_t i = 0;
+  for(; i < rule->group->nPlans; i++) {
+    const howler_device *dev = &(ctx->devices[rule->group->plans[i].device]);
+    memcpy(rule->saved_banks[i], dev->logical_banks,
+           sizeof(rule->saved_banks[i]));
+  }
+  rule->saved = 1;
+}
+
+// Writes back only the slots of the group, so that LEDs outside of it keep
+// whatever they were set to since.
+static void restore_group(howler_context *ctx, howler_reaction *rule) {
+  size_t i = 0;
+  for(; i < rule->group->nPlans; i++) {
+    const howler_led_group_plan *plan = &(rule->group->plans[i]);
+    howler_device *dev = &(ctx->devices[plan->device]);
+
+    int bank = 0;
+    for(; bank < 6; bank++) {
+      unsigned int slots = plan->slots[bank];
+      while(slots) {
+        int slot = __builtin_ctz(slots);
+        slots &= slots - 1;
+
+        howler_led_channel value = rule->saved_banks[i][bank][slot];
+        if(dev->logical_banks[bank][slot] != value) {
+          dev->logical_banks[bank][slot] = value;
+          dev->marked_banks |= 1 << bank;
+        }
+      }
+    }
+  }
+  rule->saved = 0;
+}
+
+static void run_action(howler_context *ctx, howler_reaction *rule,
+                       howler_reaction_action action) {
+  switch(action) {
+  case HOWLER_REACTION_SET_COLOR: {
+    if(!rule->saved) {
+      save_group(ctx, rule);
+    }
+
+    const howler_led_channel values[3] = {
+      rule->color.red, rule->color.green, rule->color.blue
+    };
+    howler_led_group_write(ctx, rule->group, values, 0x3F);
+  }
+  break;
+
+  case HOWLER_REACTION_RESTORE:
+    if(rule->saved) {
+      restore_group(ctx, rule);
+    }
+    break;
+
+  case HOWLER_REACTION_PLAY_TIMELINE:
+    howler_play_timeline(ctx, rule->timeline, rule->loop);
+    break;
+
+  case HOWLER_REACTION_STOP_TIMELINE:
+    // A rule without a timeline stops whatever is playing.
+    if(!rule->timeline || ctx->timeline == rule->timeline) {
+      howler_stop_timeline(ctx);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+void howler_run_reactions(howler_device *dev, howler_input_mask changed,
+                          howler_input_mask state) {
+  howler_context *ctx = dev->ctx;
+  if(!(changed & ctx->reaction_inputs)) {
+    return;
+  }
+
+  unsigned int device = dev - ctx->devices;
+  size_t i = 0;
+  for(; i < ctx->nReactions; i++) {
+    howler_reaction *rule = &(ctx->reactions[i]);
+    howler_input_mask bit = (howler_input_mask)1 << rule->input;
+    if(rule->device != device || !(changed & bit)) {
+      continue;
+    }
+
+    run_action(ctx, rule, (state & bit)? rule->on_press : rule->on_release);
+  }
+
+  // Rules of one device can light LEDs of any other, so every device with
+  // marked banks is committed once all the rules ran.
+  unsigned int d = 0;
+  for(; d < ctx->nDevices; d++) {
+    if(ctx->devices[d].marked_banks) {
+      howler_commit_marked_banks(&(ctx->devices[d]));
+    }
+  }
+}
@@ -0,0 +1,127 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void put_le64(unsigned char *dst, uint64_t v) {
+  int i = 0;
+  for(; i < 8; i++) {
+    dst[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static uint64_t get_le64(const unsigned char *src) {
+  uint64_t v = 0;
+  int i = 0;
+  for(; i < 8; i++) {
+    v |= (uint64_t)(src[i]) << (8 * i);
+  }
+  return v;
+}
+
+int howler_start_recording(howler_context *ctx, const char *path) {
+  if(!ctx || !path) { return HOWLER_ERROR_INVALID_PTR; }
+
+  howler_stop_recording(ctx);
+
+  FILE *fp = fopen(path, "wb");
+  if(!fp) {
+    fprintf(stderr, "ERROR: Unable to open trace file %s\n", path);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  unsigned char header[12];
+  memcpy(header, HOWLER_TRACE_MAGIC, 8);
+  header[8] = HOWLER_TRACE_VERSION;
+  header[9] = header[10] = header[11] = 0;
+  if(fwrite(header, sizeof(header), 1, fp) != 1) {
+    fclose(fp);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  ctx->trace_file = fp;
+  ctx->trace_start_ns = howler_get_time_ns();
+  return HOWLER_SUCCESS;
+}
+
+void howler_stop_recording(howler_context *ctx) {
+  if(!ctx || !ctx->trace_file) { return; }
+
+  fclose((FILE *)ctx->trace_file);
+  ctx->trace_file = NULL;
+}
+
+void howler_record_frame(howler_device *dev, howler_trace_kind kind,
+                         uint64_t time_ns, int status,
+                         const unsigned char *frame) {
+  // Devices are still being opened when the first commands go out.
+  howler_context *ctx = dev->ctx;
+  if(!ctx || !ctx->trace_file) { return; }
+
+  unsigned char record[HOWLER_TRACE_RECORD_SIZE];
+  memset(record, 0, sizeof(record));
+
+  put_le64(record, time_ns > ctx->trace_start_ns? time_ns - ctx->trace_start_ns : 0);
+  record[8] = (unsigned char)(dev - ctx->devices);
+  record[9] = (unsigned char)kind;
+  record[10] = (unsigned char)(signed char)status;
+  if(frame) {
+    memcpy(record + 12, frame, HOWLER_COMMAND_SIZE);
+  }
+
+  if(fwrite(record, sizeof(record), 1, (FILE *)ctx->trace_file) != 1) {
+    fprintf(stderr, "ERROR: Unable to write trace record, recording stopped\n");
+    howler_stop_recording(ctx);
+  }
+}
+
+int howler_trace_read_header(FILE *fp) {
+  unsigned char header[12];
+  if(fread(header, sizeof(header), 1, fp) != 1) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  if(memcmp(header, HOWLER_TRACE_MAGIC, 8) != 0 ||
+     header[8] != HOWLER_TRACE_VERSION) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  return HOWLER_SUCCESS;
+}
+
+int howler_trace_read_record(FILE *fp, howler_trace_record *record) {
+  unsigned char buf[HOWLER_TRACE_RECORD_SIZE];
+  if(fread(buf, sizeof(buf), 1, fp) != 1) {
+    return 0;
+  }
+
+  record->time_ns = get_le64(buf);
+  record->device = buf[8];
+  record->kind = buf[9];
+  record->status = (signed char)buf[10];
+  memcpy(record->data, buf + 12, HOWLER_COMMAND_SIZE);
+  return 1;
+}
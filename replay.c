@@ -0,0 +1,589 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* howler-replay reads traces written by the traffic recorder (see
+ * howler_start_recording) and either summarizes them, checks them against a
+ * simulated device, or replays them against real hardware with their
+ * original timing. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "howler.h"
+
+#define MAX_TRACE_DEVICES 256
+
+static void print_usage() {
+  printf("Usage: howler-replay COMMAND TRACE [OPTIONS]\n");
+  printf("\n");
+  printf("    COMMAND is one of the following:\n");
+  printf("        summary TRACE\n");
+  printf("            Command mix, redundant writes and inter-command gaps\n");
+  printf("        simulate TRACE\n");
+  printf("            Feeds the commands to a simulated device and reports\n");
+  printf("            responses that differ from the recorded ones\n");
+  printf("        retime TRACE [DEVICE] [SPEED]\n");
+  printf("            Sends the commands to a real device at their recorded\n");
+  printf("            times, scaled by SPEED (default 1.0), and compares the\n");
+  printf("            round trip times\n");
+}
+
+static const char *command_name(unsigned char cmd) {
+  switch(cmd) {
+    case CMD_SET_RGB_LED: return "SET_RGB_LED";
+    case CMD_SET_INDIVIDUAL_LED: return "SET_INDIVIDUAL_LED";
+    case CMD_SET_INPUT: return "SET_INPUT";
+    case CMD_GET_INPUT: return "GET_INPUT";
+    case CMD_SET_DEFAULT: return "SET_DEFAULT";
+    case CMD_SET_GLOBAL_BRIGHTNESS: return "SET_GLOBAL_BRIGHTNESS";
+    case CMD_SET_RGB_LED_DEFAULT: return "SET_RGB_LED_DEFAULT";
+    case CMD_GET_RGB_LED: return "GET_RGB_LED";
+    case CMD_SET_RGB_LED_BANK: return "SET_RGB_LED_BANK";
+    case CMD_GET_FW_REV: return "GET_FW_REV";
+    case CMD_GET_ACCEL_DATA: return "GET_ACCEL_DATA";
+    default: return "UNKNOWN";
+  }
+}
+
+/*******************************************************************************
+ *
+ * Simulated device
+ *
+ ******************************************************************************/
+
+/* LED state is kept in frame order: three channels per LED, in the order
+ * joysticks, buttons, high powered LEDs. */
+typedef struct {
+  unsigned char frame[HOWLER_NUM_LEDS * 3];
+  unsigned char known[HOWLER_NUM_LEDS * 3];
+  unsigned char brightness;
+  int brightness_known;
+} sim_device;
+
+typedef enum {
+  SIM_CHANGED,
+  SIM_REDUNDANT,
+  SIM_NOT_A_WRITE
+} sim_result;
+
+static int sim_set(sim_device *sim, unsigned int pos, unsigned char value) {
+  if(pos >= sizeof(sim->frame)) {
+    return 0;
+  }
+
+  int changed = !sim->known[pos] || sim->frame[pos] != value;
+  sim->frame[pos] = value;
+  sim->known[pos] = 1;
+  return changed;
+}
+
+/* Applies a command to the simulated device. If it is a read whose answer is
+ * known, the expected response is written to response and *have_response is
+ * set. */
+static sim_result sim_apply(sim_device *sim, const unsigned char *cmd,
+                            unsigned char *response, int *have_response) {
+  int changed = 0;
+  unsigned int i;
+
+  *have_response = 0;
+  memset(response, 0, HOWLER_COMMAND_SIZE);
+  response[0] = CMD_HOWLER_ID;
+  response[1] = cmd[1];
+
+  switch(cmd[1]) {
+    case CMD_SET_RGB_LED:
+      for(i = 0; i < 3; i++) {
+        changed |= sim_set(sim, 3 * cmd[2] + i, cmd[3 + i]);
+      }
+      break;
+
+    case CMD_SET_INDIVIDUAL_LED:
+      changed = sim_set(sim, cmd[2], cmd[3]);
+      break;
+
+    case CMD_SET_RGB_LED_BANK:
+      if(cmd[2] < 1 || cmd[2] > 6) {
+        return SIM_NOT_A_WRITE;
+      }
+
+      for(i = 0; i < 16; i++) {
+        unsigned int bank_pos = (cmd[2] - 1) * 16 + i;
+        changed |= sim_set(sim, howler_frame_to_banks[bank_pos], cmd[3 + i]);
+      }
+      break;
+
+    case CMD_SET_GLOBAL_BRIGHTNESS:
+      changed = !sim->brightness_known || sim->brightness != cmd[2];
+      sim->brightness = cmd[2];
+      sim->brightness_known = 1;
+      break;
+
+    case CMD_GET_RGB_LED:
+      if(cmd[2] < HOWLER_NUM_LEDS) {
+        unsigned int pos = 3 * cmd[2];
+        *have_response = sim->known[pos] && sim->known[pos + 1] &&
+                         sim->known[pos + 2];
+        memcpy(response + 2, sim->frame + pos, 3);
+      }
+      return SIM_NOT_A_WRITE;
+
+    case CMD_SET_INPUT:
+      // The device echoes the mapping back.
+      memcpy(response, cmd, 6);
+      *have_response = 1;
+      return SIM_CHANGED;
+
+    default:
+      return SIM_NOT_A_WRITE;
+  }
+
+  return changed? SIM_CHANGED : SIM_REDUNDANT;
+}
+
+/* Records what the device reported, so that later reads can be checked. */
+static void sim_learn(sim_device *sim, const unsigned char *cmd,
+                      const unsigned char *response) {
+  if(cmd[1] == CMD_GET_RGB_LED && cmd[2] < HOWLER_NUM_LEDS &&
+     response[0] == CMD_HOWLER_ID && response[1] == CMD_GET_RGB_LED) {
+    unsigned int i = 0;
+    for(; i < 3; i++) {
+      sim_set(sim, 3 * cmd[2] + i, response[2 + i]);
+    }
+  }
+}
+
+/*******************************************************************************
+ *
+ * Trace reading
+ *
+ ******************************************************************************/
+
+static FILE *open_trace(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if(!fp) {
+    fprintf(stderr, "Unable to open %s\n", path);
+    return NULL;
+  }
+
+  if(howler_trace_read_header(fp) < 0) {
+    fprintf(stderr, "%s is not a Howler trace\n", path);
+    fclose(fp);
+    return NULL;
+  }
+
+  return fp;
+}
+
+/* Commands of different devices, and commands that were queued, interleave
+ * in a trace, so each response is matched to the unanswered command of its
+ * device. Every device has at most one command on the wire, which is
+ * answered, if at all, before the device's next command is sent. Commands
+ * are handed out in the order they were sent, once their response is known,
+ * through a window of TRACE_WINDOW commands. */
+#define TRACE_WINDOW 64
+
+typedef struct {
+  howler_trace_record cmd;
+  howler_trace_record response;
+  int has_response;
+  int resolved;
+} trace_entry;
+
+typedef struct {
+  FILE *fp;
+  int eof;
+  trace_entry entries[TRACE_WINDOW];
+  unsigned int head;
+  unsigned int count;
+
+  // A command read while the window was full.
+  howler_trace_record next;
+  int have_next;
+
+  // Index in entries of the unanswered command of each device, or -1.
+  int open[MAX_TRACE_DEVICES];
+} trace_reader;
+
+static void trace_reader_init(trace_reader *reader, FILE *fp) {
+  memset(reader, 0, sizeof(*reader));
+  reader->fp = fp;
+
+  int i = 0;
+  for(; i < MAX_TRACE_DEVICES; i++) {
+    reader->open[i] = -1;
+  }
+}
+
+/* Gives up on a response for the oldest command, when the window is full. */
+static void resolve_oldest(trace_reader *reader) {
+  trace_entry *oldest = &(reader->entries[reader->head]);
+  oldest->resolved = 1;
+  if(reader->open[oldest->cmd.device] == (int)reader->head) {
+    reader->open[oldest->cmd.device] = -1;
+  }
+}
+
+static void add_record(trace_reader *reader, const howler_trace_record *record) {
+  int *open = &(reader->open[record->device]);
+
+  if(record->kind == HOWLER_TRACE_RESPONSE) {
+    // Stray responses are skipped.
+    if(*open >= 0) {
+      reader->entries[*open].response = *record;
+      reader->entries[*open].has_response = 1;
+      reader->entries[*open].resolved = 1;
+      *open = -1;
+    }
+    return;
+  }
+
+  if(record->kind != HOWLER_TRACE_COMMAND) {
+    return;
+  }
+
+  // The previous command of the device went unanswered.
+  if(*open >= 0) {
+    reader->entries[*open].resolved = 1;
+    *open = -1;
+  }
+
+  unsigned int idx = (reader->head + reader->count) % TRACE_WINDOW;
+  trace_entry *entry = &(reader->entries[idx]);
+  entry->cmd = *record;
+  entry->has_response = 0;
+  entry->resolved = 0;
+  reader->count++;
+  *open = idx;
+}
+
+/* Reads the next command along with its response, if it got one. Returns 1
+ * for each command and 0 at the end of the trace. */
+static int read_command(trace_reader *reader, howler_trace_record *cmd,
+                        howler_trace_record *response, int *has_response) {
+  for(;;) {
+    trace_entry *oldest = &(reader->entries[reader->head]);
+    if(reader->count > 0 && (oldest->resolved || reader->eof)) {
+      *cmd = oldest->cmd;
+      *has_response = oldest->has_response;
+      if(oldest->has_response) {
+        *response = oldest->response;
+      }
+
+      if(reader->open[oldest->cmd.device] == (int)reader->head) {
+        reader->open[oldest->cmd.device] = -1;
+      }
+      reader->head = (reader->head + 1) % TRACE_WINDOW;
+      reader->count--;
+      return 1;
+    }
+
+    if(reader->eof) {
+      return 0;
+    }
+
+    howler_trace_record record;
+    if(reader->have_next) {
+      record = reader->next;
+      reader->have_next = 0;
+    } else if(!howler_trace_read_record(reader->fp, &record)) {
+      reader->eof = 1;
+      continue;
+    }
+
+    if(reader->count == TRACE_WINDOW && record.kind == HOWLER_TRACE_COMMAND) {
+      // Make room by handing out the oldest command first.
+      resolve_oldest(reader);
+      reader->next = record;
+      reader->have_next = 1;
+      continue;
+    }
+    add_record(reader, &record);
+  }
+}
+
+static void print_histogram_summary(const char *name,
+                                    const howler_latency_histogram *hist) {
+  if(!hist->count) {
+    fprintf(stdout, "%s: no samples\n", name);
+    return;
+  }
+
+  fprintf(stdout, "%s (us): min %.2f, avg %.2f, max %.2f, p50 < %.2f, p99 < %.2f\n",
+          name,
+          hist->min_ns / 1000.0,
+          hist->total_ns / (1000.0 * hist->count),
+          hist->max_ns / 1000.0,
+          howler_latency_histogram_percentile(hist, 50.0) / 1000.0,
+          howler_latency_histogram_percentile(hist, 99.0) / 1000.0);
+}
+
+/*******************************************************************************
+ *
+ * Commands
+ *
+ ******************************************************************************/
+
+static int run_summary(const char *path) {
+  FILE *fp = open_trace(path);
+  if(!fp) { return -1; }
+
+  static trace_reader reader;
+  trace_reader_init(&reader, fp);
+
+  static sim_device sims[MAX_TRACE_DEVICES];
+  unsigned long long counts[256];
+  unsigned long long redundant[256];
+  memset(counts, 0, sizeof(counts));
+  memset(redundant, 0, sizeof(redundant));
+
+  unsigned long long nCommands = 0, nResponses = 0, nErrors = 0;
+  uint64_t first_ns = 0, last_ns = 0;
+
+  howler_latency_histogram gaps, round_trips;
+  howler_latency_histogram_reset(&gaps);
+  howler_latency_histogram_reset(&round_trips);
+
+  howler_trace_record cmd, response;
+  int has_response;
+  while(read_command(&reader, &cmd, &response, &has_response)) {
+    if(nCommands == 0) {
+      first_ns = cmd.time_ns;
+    } else {
+      howler_latency_histogram_add(&gaps, cmd.time_ns - last_ns);
+    }
+    last_ns = cmd.time_ns;
+    nCommands++;
+
+    nErrors += (cmd.status < 0);
+    counts[cmd.data[1]]++;
+
+    sim_device *sim = &sims[cmd.device];
+    unsigned char expected[HOWLER_COMMAND_SIZE];
+    int have_expected;
+    if(sim_apply(sim, cmd.data, expected, &have_expected) == SIM_REDUNDANT) {
+      redundant[cmd.data[1]]++;
+    }
+
+    if(has_response) {
+      nResponses++;
+      nErrors += (response.status < 0);
+      howler_latency_histogram_add(&round_trips, response.time_ns - cmd.time_ns);
+      sim_learn(sim, cmd.data, response.data);
+    }
+  }
+  fclose(fp);
+
+  fprintf(stdout, "Commands: %llu, responses: %llu, errors: %llu\n",
+          nCommands, nResponses, nErrors);
+  fprintf(stdout, "Duration: %.3f ms\n", (last_ns - first_ns) / 1000000.0);
+  fprintf(stdout, "\n%-24s %10s %10s\n", "Command", "Count", "Redundant");
+
+  unsigned long long total_redundant = 0;
+  int i = 0;
+  for(; i < 256; i++) {
+    if(!counts[i]) {
+      continue;
+    }
+
+    fprintf(stdout, "%-24s %10llu %10llu\n", command_name(i), counts[i], redundant[i]);
+    total_redundant += redundant[i];
+  }
+
+  fprintf(stdout, "\nRedundant writes: %llu (%.1f%% of commands)\n",
+          total_redundant,
+          nCommands? (100.0 * total_redundant) / nCommands : 0.0);
+  print_histogram_summary("Inter-command gap", &gaps);
+  print_histogram_summary("Round trip", &round_trips);
+  return 0;
+}
+
+static int run_simulate(const char *path) {
+  FILE *fp = open_trace(path);
+  if(!fp) { return -1; }
+
+  static trace_reader reader;
+  trace_reader_init(&reader, fp);
+
+  static sim_device sims[MAX_TRACE_DEVICES];
+  unsigned long long nCommands = 0, nChecked = 0, nMismatches = 0;
+
+  howler_trace_record cmd, response;
+  int has_response;
+  while(read_command(&reader, &cmd, &response, &has_response)) {
+    nCommands++;
+
+    sim_device *sim = &sims[cmd.device];
+    unsigned char expected[HOWLER_COMMAND_SIZE];
+    int have_expected;
+    sim_apply(sim, cmd.data, expected, &have_expected);
+
+    if(!has_response || response.status < 0) {
+      continue;
+    }
+
+    if(have_expected) {
+      nChecked++;
+      if(memcmp(expected, response.data, 6) != 0) {
+        nMismatches++;
+        fprintf(stdout, "%12.3f ms device %d %s: expected %02x %02x %02x %02x, "
+                "recorded %02x %02x %02x %02x\n",
+                cmd.time_ns / 1000000.0, cmd.device, command_name(cmd.data[1]),
+                expected[2], expected[3], expected[4], expected[5],
+                response.data[2], response.data[3], response.data[4],
+                response.data[5]);
+      }
+    }
+
+    sim_learn(sim, cmd.data, response.data);
+  }
+  fclose(fp);
+
+  fprintf(stdout, "Commands: %llu, responses checked: %llu, mismatches: %llu\n",
+          nCommands, nChecked, nMismatches);
+  return nMismatches? -1 : 0;
+}
+
+static int sleep_until(uint64_t deadline_ns) {
+  struct timespec ts;
+  ts.tv_sec = deadline_ns / 1000000000ULL;
+  ts.tv_nsec = deadline_ns % 1000000000ULL;
+
+  int err;
+  while((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR);
+  if(err != 0) {
+    fprintf(stderr, "ERROR: Unable to sleep: %s\n", strerror(err));
+    return -1;
+  }
+  return 0;
+}
+
+static int run_retime(const char *path, int device_idx, double speed) {
+  FILE *fp = open_trace(path);
+  if(!fp) { return -1; }
+
+  static trace_reader reader;
+  trace_reader_init(&reader, fp);
+
+  howler_context *ctx;
+  if(howler_init(&ctx) < 0) {
+    fprintf(stderr, "Howler initialization failed.\n");
+    fclose(fp);
+    return -1;
+  }
+
+  int err = 0;
+  howler_device *dev = howler_get_device(ctx, device_idx);
+  if(!dev) {
+    fprintf(stderr, "No Howler device %d\n", device_idx);
+    err = -1;
+    goto done;
+  }
+
+  howler_latency_histogram recorded, replayed, lateness;
+  howler_latency_histogram_reset(&recorded);
+  howler_latency_histogram_reset(&replayed);
+  howler_latency_histogram_reset(&lateness);
+
+  unsigned long long nCommands = 0, nErrors = 0;
+  uint64_t trace_start_ns = 0, start_ns = 0, end_ns = 0, trace_end_ns = 0;
+
+  // Every device in the trace is replayed on the chosen one.
+  howler_trace_record cmd, response;
+  int has_response;
+  while(read_command(&reader, &cmd, &response, &has_response)) {
+    if(nCommands == 0) {
+      trace_start_ns = cmd.time_ns;
+      start_ns = howler_get_time_ns();
+    }
+    nCommands++;
+
+    uint64_t due_ns = start_ns + (uint64_t)((cmd.time_ns - trace_start_ns) / speed);
+    if(sleep_until(due_ns) < 0) {
+      err = -1;
+      break;
+    }
+
+    uint64_t sent_ns = howler_get_time_ns();
+    howler_latency_histogram_add(&lateness, sent_ns - due_ns);
+
+    unsigned char output[HOWLER_COMMAND_SIZE];
+    if(howler_sendrcv(dev, cmd.data, has_response? output : NULL) < 0) {
+      nErrors++;
+    }
+    end_ns = howler_get_time_ns();
+    trace_end_ns = has_response? response.time_ns : cmd.time_ns;
+
+    if(has_response) {
+      howler_latency_histogram_add(&recorded, response.time_ns - cmd.time_ns);
+      howler_latency_histogram_add(&replayed, end_ns - sent_ns);
+    }
+  }
+
+  fprintf(stdout, "Commands: %llu, errors: %llu\n", nCommands, nErrors);
+  fprintf(stdout, "Duration (ms): recorded %.3f, replayed %.3f at %.2fx\n",
+          (trace_end_ns - trace_start_ns) / 1000000.0,
+          (end_ns - start_ns) / 1000000.0, speed);
+  print_histogram_summary("Recorded round trip", &recorded);
+  print_histogram_summary("Replayed round trip", &replayed);
+  print_histogram_summary("Send lateness", &lateness);
+
+ done:
+  fclose(fp);
+  howler_destroy(ctx);
+  return err;
+}
+
+int main(int argc, const char **argv) {
+  if(argc < 3) {
+    print_usage();
+    return 1;
+  }
+
+  int err;
+  if(strcmp(argv[1], "summary") == 0) {
+    err = run_summary(argv[2]);
+  } else if(strcmp(argv[1], "simulate") == 0) {
+    err = run_simulate(argv[2]);
+  } else if(strcmp(argv[1], "retime") == 0) {
+    int device_idx = 0;
+    double speed = 1.0;
+    if(argc > 3 && sscanf(argv[3], "%d", &device_idx) != 1) {
+      fprintf(stderr, "Invalid device index: %s\n", argv[3]);
+      return 1;
+    }
+
+    if(argc > 4 && (sscanf(argv[4], "%lf", &speed) != 1 || speed <= 0.0)) {
+      fprintf(stderr, "Invalid speed: %s\n", argv[4]);
+      return 1;
+    }
+
+    err = run_retime(argv[2], device_idx, speed);
+  } else {
+    print_usage();
+    return 1;
+  }
+
+  return (err < 0)? 1 : 0;
+}
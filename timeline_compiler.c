@@ -0,0 +1,440 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* howler-timeline compiles text descriptions of light shows into the timeline
+ * format played by howler_play_timeline, and can describe or play the
+ * result.
+ *
+ * A description is read line by line, and everything after a '#' is a
+ * comment:
+ *
+ *     devices N        Number of devices in the show (default 1), given
+ *                      before the first frame
+ *     at MS            Starts the frame shown MS milliseconds into the show
+ *     device N         Following colors apply to device N, from 0
+ *     J# R G B         Sets joystick, button or high power LED # of the
+ *     B# R G B         current device, with channel values from 0 to 255
+ *     H# R G B
+ *     all R G B        Sets every LED of the current device
+ *     end MS           Length of the show (default: the time of the last
+ *                      frame), which is when a looping show starts over
+ *
+ * Colors carry over from one frame to the next, so each frame only needs the
+ * LEDs that change. Every LED starts off. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "howler.h"
+
+#define MAX_TIMELINE_DEVICES 256
+
+static void print_usage() {
+  printf("Usage: howler-timeline COMMAND [OPTIONS]\n");
+  printf("\n");
+  printf("    COMMAND is one of the following:\n");
+  printf("        compile DESCRIPTION TIMELINE\n");
+  printf("            Builds TIMELINE from the text in DESCRIPTION\n");
+  printf("        info TIMELINE\n");
+  printf("            Frame count, duration and bank writes of TIMELINE\n");
+  printf("        play TIMELINE [loop]\n");
+  printf("            Plays TIMELINE on the connected devices\n");
+}
+
+/*******************************************************************************
+ *
+ * Compiler
+ *
+ ******************************************************************************/
+
+typedef struct {
+  const char *path;
+  int line;
+
+  FILE *out;
+  unsigned int num_devices;
+  unsigned int device;
+  int started;
+
+  // The colors of each device, and the banks last written for it.
+  howler_led_frame *frames;
+  howler_led_bank (*written)[6];
+  unsigned char *has_written;
+
+  uint64_t time_ns;
+  uint64_t end_ns;
+  unsigned int num_frames;
+} compiler;
+
+static void syntax_error(const compiler *c, const char *msg) {
+  fprintf(stderr, "%s:%d: %s\n", c->path, c->line, msg);
+}
+
+/* Writes the banks of every device that changed since its last frame. The
+ * first frame of a device holds all of its banks. */
+static int flush_frame(compiler *c) {
+  unsigned int d = 0;
+  for(; d < c->num_devices; d++) {
+    howler_led_bank banks[6];
+    howler_led_frame_to_banks(banks, c->frames[d]);
+
+    unsigned int mask = 0x3F;
+    if(c->has_written[d]) {
+      mask = howler_led_banks_diff(banks, c->written[d]);
+    }
+
+    if(!mask) {
+      continue;
+    }
+
+    if(howler_timeline_write_frame(c->out, c->time_ns, (unsigned char)d,
+                                   mask, banks) < 0) {
+      fprintf(stderr, "Unable to write timeline frame\n");
+      return -1;
+    }
+
+    memcpy(c->written[d], banks, sizeof(banks));
+    c->has_written[d] = 1;
+    c->num_frames++;
+  }
+
+  return 0;
+}
+
+static int parse_ms(const compiler *c, const char *str, uint64_t *ns) {
+  double ms;
+  if(!str || sscanf(str, "%lf", &ms) != 1 || ms < 0.0) {
+    syntax_error(c, "Expected a time in milliseconds");
+    return -1;
+  }
+
+  *ns = (uint64_t)(ms * 1000000.0 + 0.5);
+  return 0;
+}
+
+static int parse_color(const compiler *c, char **tokens, howler_led *led) {
+  unsigned int rgb[3];
+  int i = 0;
+  for(; i < 3; i++) {
+    if(!tokens[i] || sscanf(tokens[i], "%u", &(rgb[i])) != 1 || rgb[i] > 255) {
+      syntax_error(c, "Expected a color as three values from 0 to 255");
+      return -1;
+    }
+  }
+
+  led->red = rgb[0];
+  led->green = rgb[1];
+  led->blue = rgb[2];
+  return 0;
+}
+
+static int start_show(compiler *c) {
+  c->frames = calloc(c->num_devices, sizeof(howler_led_frame));
+  c->written = calloc(c->num_devices, sizeof(*(c->written)));
+  c->has_written = calloc(c->num_devices, 1);
+  if(!c->frames || !c->written || !c->has_written) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  c->started = 1;
+  return 0;
+}
+
+static int compile_line(compiler *c, char *line) {
+  char *comment = strchr(line, '#');
+  if(comment) {
+    *comment = '\0';
+  }
+
+  char *tokens[6];
+  int nTokens = 0;
+  char *tok = strtok(line, " \t\r\n");
+  for(; tok && nTokens < 6; tok = strtok(NULL, " \t\r\n")) {
+    tokens[nTokens++] = tok;
+  }
+
+  if(nTokens == 0) {
+    return 0;
+  }
+
+  int i = nTokens;
+  for(; i < 6; i++) {
+    tokens[i] = NULL;
+  }
+
+  if(strcmp(tokens[0], "devices") == 0) {
+    unsigned int n;
+    if(c->started) {
+      syntax_error(c, "devices must come before the first frame");
+      return -1;
+    }
+
+    if(!tokens[1] || sscanf(tokens[1], "%u", &n) != 1 ||
+       n < 1 || n > MAX_TIMELINE_DEVICES) {
+      syntax_error(c, "Expected a number of devices from 1 to 256");
+      return -1;
+    }
+
+    c->num_devices = n;
+    return 0;
+  }
+
+  if(strcmp(tokens[0], "at") == 0) {
+    uint64_t ns;
+    if(parse_ms(c, tokens[1], &ns) < 0) {
+      return -1;
+    }
+
+    if(!c->started) {
+      c->time_ns = ns;
+      return start_show(c);
+    }
+
+    if(ns < c->time_ns) {
+      syntax_error(c, "Frames must be in order of time");
+      return -1;
+    }
+
+    if(flush_frame(c) < 0) {
+      return -1;
+    }
+
+    c->time_ns = ns;
+    return 0;
+  }
+
+  if(strcmp(tokens[0], "end") == 0) {
+    return parse_ms(c, tokens[1], &(c->end_ns));
+  }
+
+  if(!c->started) {
+    syntax_error(c, "Expected 'at' before the first color");
+    return -1;
+  }
+
+  if(strcmp(tokens[0], "device") == 0) {
+    unsigned int d;
+    if(!tokens[1] || sscanf(tokens[1], "%u", &d) != 1 || d >= c->num_devices) {
+      syntax_error(c, "Invalid device; is 'devices' set?");
+      return -1;
+    }
+
+    c->device = d;
+    return 0;
+  }
+
+  howler_led led;
+  if(strcmp(tokens[0], "all") == 0) {
+    if(parse_color(c, tokens + 1, &led) < 0) {
+      return -1;
+    }
+
+    for(i = 0; i < HOWLER_NUM_LEDS; i++) {
+      c->frames[c->device][i] = led;
+    }
+    return 0;
+  }
+
+  int index = howler_parse_led_name(tokens[0]);
+  if(index < 0) {
+    syntax_error(c, "Expected a command or a control of the form J#, B# or H#");
+    return -1;
+  }
+
+  if(parse_color(c, tokens + 1, &led) < 0) {
+    return -1;
+  }
+
+  c->frames[c->device][index] = led;
+  return 0;
+}
+
+static int run_compile(const char *in_path, const char *out_path) {
+  FILE *in = fopen(in_path, "r");
+  if(!in) {
+    fprintf(stderr, "Unable to open %s\n", in_path);
+    return -1;
+  }
+
+  FILE *out = fopen(out_path, "wb");
+  if(!out) {
+    fprintf(stderr, "Unable to open %s\n", out_path);
+    fclose(in);
+    return -1;
+  }
+
+  compiler c;
+  memset(&c, 0, sizeof(c));
+  c.path = in_path;
+  c.out = out;
+  c.num_devices = 1;
+
+  // The header is rewritten once the frame count is known.
+  int err = howler_timeline_write_header(out, 0, 0, 0);
+
+  char line[512];
+  while(err == 0 && fgets(line, sizeof(line), in)) {
+    c.line++;
+    err = compile_line(&c, line);
+  }
+
+  if(err == 0 && c.started) {
+    err = flush_frame(&c);
+  }
+
+  if(err == 0) {
+    uint64_t duration_ns = (c.end_ns > c.time_ns)? c.end_ns : c.time_ns;
+    rewind(out);
+    err = howler_timeline_write_header(out, c.num_devices, c.num_frames,
+                                       duration_ns);
+    if(err == 0) {
+      printf("%s: %u frames for %u devices, %.3f seconds\n", out_path,
+             c.num_frames, c.num_devices, (double)duration_ns / 1e9);
+    }
+  }
+
+  if(fclose(out) != 0 && err == 0) {
+    fprintf(stderr, "Unable to write %s\n", out_path);
+    err = -1;
+  }
+
+  fclose(in);
+  free(c.frames);
+  free(c.written);
+  free(c.has_written);
+
+  if(err < 0) {
+    remove(out_path);
+  }
+  return err;
+}
+
+/*******************************************************************************
+ *
+ * Inspection and playback
+ *
+ ******************************************************************************/
+
+static int run_info(const char *path) {
+  howler_timeline tl;
+  if(howler_timeline_open(&tl, path) < 0) {
+    return -1;
+  }
+
+  unsigned long long banks = 0;
+  unsigned int frames = 0;
+  size_t offset = HOWLER_TIMELINE_HEADER_SIZE;
+  while(tl.size - offset >= HOWLER_TIMELINE_FRAME_HEADER_SIZE) {
+    unsigned int mask = tl.data[offset + 9] & 0x3F;
+    unsigned int nBanks = 0;
+    for(; mask; mask &= mask - 1) {
+      nBanks++;
+    }
+
+    banks += nBanks;
+    frames++;
+    offset += HOWLER_TIMELINE_FRAME_HEADER_SIZE + nBanks * sizeof(howler_led_bank);
+  }
+
+  printf("Devices: %u\n", tl.num_devices);
+  printf("Frames: %u\n", frames);
+  printf("Duration: %.3f seconds\n", (double)tl.duration_ns / 1e9);
+  printf("Size: %lu bytes\n", (unsigned long)tl.size);
+  printf("Bank writes: %llu (%.2f per frame, %.1f%% of full frames)\n", banks,
+         frames? (double)banks / frames : 0.0,
+         frames? 100.0 * banks / (6.0 * frames) : 0.0);
+
+  if(frames != tl.num_frames || offset != tl.size) {
+    printf("WARNING: the header lists %u frames; the file may be truncated\n",
+           tl.num_frames);
+  }
+
+  howler_timeline_close(&tl);
+  return 0;
+}
+
+static int frames_in_flight(const howler_context *ctx) {
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    const howler_frame_pacer *pacer = &(ctx->devices[i].frame_pacer);
+    if(pacer->pending || pacer->in_flight) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int run_play(const char *path, int loop) {
+  howler_timeline tl;
+  if(howler_timeline_open(&tl, path) < 0) {
+    return -1;
+  }
+
+  howler_context *ctx;
+  if(howler_init(&ctx) < 0) {
+    howler_timeline_close(&tl);
+    return -1;
+  }
+
+  if(howler_get_num_connected(ctx) < tl.num_devices) {
+    fprintf(stderr, "WARNING: the show is for %u devices, %lu are connected\n",
+            tl.num_devices, (unsigned long)howler_get_num_connected(ctx));
+  }
+
+  int err = howler_play_timeline(ctx, &tl, loop);
+  while(err == 0 && howler_timeline_playing(ctx)) {
+    err = howler_handle_events(ctx, 1000);
+  }
+
+  // Let the last frames reach the devices.
+  while(err == 0 && frames_in_flight(ctx)) {
+    err = howler_handle_events(ctx, 10);
+  }
+
+  howler_destroy(ctx);
+  howler_timeline_close(&tl);
+  return err;
+}
+
+int main(int argc, const char **argv) {
+  if(argc < 3) {
+    print_usage();
+    return 1;
+  }
+
+  int err;
+  if(strcmp(argv[1], "compile") == 0 && argc > 3) {
+    err = run_compile(argv[2], argv[3]);
+  } else if(strcmp(argv[1], "info") == 0) {
+    err = run_info(argv[2]);
+  } else if(strcmp(argv[1], "play") == 0) {
+    err = run_play(argv[2], argc > 3 && strcmp(argv[3], "loop") == 0);
+  } else {
+    print_usage();
+    return 1;
+  }
+
+  return (err < 0)? 1 : 0;
+}
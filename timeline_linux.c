@@ -0,0 +1,279 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void put_le32(unsigned char *dst, uint32_t v) {
+  int i = 0;
+  for(; i < 4; i++) {
+    dst[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static void put_le64(unsigned char *dst, uint64_t v) {
+  int i = 0;
+  for(; i < 8; i++) {
+    dst[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static uint32_t get_le32(const unsigned char *src) {
+  uint32_t v = 0;
+  int i = 0;
+  for(; i < 4; i++) {
+    v |= (uint32_t)(src[i]) << (8 * i);
+  }
+  return v;
+}
+
+static uint64_t get_le64(const unsigned char *src) {
+  uint64_t v = 0;
+  int i = 0;
+  for(; i < 8; i++) {
+    v |= (uint64_t)(src[i]) << (8 * i);
+  }
+  return v;
+}
+
+static size_t frame_size(unsigned int bank_mask) {
+  size_t size = HOWLER_TIMELINE_FRAME_HEADER_SIZE;
+  int k = 0;
+  for(; k < 6; k++) {
+    if(bank_mask & (1 << k)) {
+      size += sizeof(howler_led_bank);
+    }
+  }
+  return size;
+}
+
+/*******************************************************************************
+ *
+ * Files
+ *
+ ******************************************************************************/
+
+int howler_timeline_open(howler_timeline *tl, const char *path) {
+  if(!tl || !path) { return HOWLER_ERROR_INVALID_PTR; }
+  memset(tl, 0, sizeof(*tl));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "ERROR: Unable to open timeline %s\n", path);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size < HOWLER_TIMELINE_HEADER_SIZE) {
+    fprintf(stderr, "ERROR: %s is not a timeline\n", path);
+    close(fd);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    fprintf(stderr, "ERROR: Unable to map timeline %s\n", path);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  // Playback only ever moves forward, so pages can be read well ahead and
+  // dropped soon after.
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  const unsigned char *header = (const unsigned char *)data;
+  if(memcmp(header, HOWLER_TIMELINE_MAGIC, 8) != 0 ||
+     get_le32(header + 8) != HOWLER_TIMELINE_VERSION) {
+    fprintf(stderr, "ERROR: %s is not a timeline\n", path);
+    munmap(data, st.st_size);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  tl->data = header;
+  tl->size = st.st_size;
+  tl->num_devices = get_le32(header + 12);
+  tl->num_frames = get_le32(header + 16);
+  tl->duration_ns = get_le64(header + 24);
+  tl->offset = HOWLER_TIMELINE_HEADER_SIZE;
+  return HOWLER_SUCCESS;
+}
+
+void howler_timeline_close(howler_timeline *tl) {
+  if(!tl || !tl->data) { return; }
+
+  munmap((void *)tl->data, tl->size);
+  memset(tl, 0, sizeof(*tl));
+}
+
+int howler_timeline_write_header(FILE *fp, unsigned int num_devices,
+                                 unsigned int num_frames, uint64_t duration_ns) {
+  unsigned char header[HOWLER_TIMELINE_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, HOWLER_TIMELINE_MAGIC, 8);
+  put_le32(header + 8, HOWLER_TIMELINE_VERSION);
+  put_le32(header + 12, num_devices);
+  put_le32(header + 16, num_frames);
+  put_le64(header + 24, duration_ns);
+
+  if(fwrite(header, sizeof(header), 1, fp) != 1) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+  return HOWLER_SUCCESS;
+}
+
+int howler_timeline_write_frame(FILE *fp, uint64_t time_ns, unsigned char dev,
+                                unsigned int bank_mask,
+                                const howler_led_bank *banks) {
+  unsigned char frame[HOWLER_TIMELINE_FRAME_HEADER_SIZE + 6 * sizeof(howler_led_bank)];
+  memset(frame, 0, HOWLER_TIMELINE_FRAME_HEADER_SIZE);
+  put_le64(frame, time_ns);
+  frame[8] = dev;
+  frame[9] = (unsigned char)(bank_mask & 0x3F);
+
+  unsigned char *dst = frame + HOWLER_TIMELINE_FRAME_HEADER_SIZE;
+  int k = 0;
+  for(; k < 6; k++) {
+    if(bank_mask & (1 << k)) {
+      memcpy(dst, banks[k], sizeof(howler_led_bank));
+      dst += sizeof(howler_led_bank);
+    }
+  }
+
+  if(fwrite(frame, dst - frame, 1, fp) != 1) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+  return HOWLER_SUCCESS;
+}
+
+/*******************************************************************************
+ *
+ * Playback
+ *
+ ******************************************************************************/
+
+/* Copies the banks of a frame over the logical banks of dev and commits the
+ * ones that differ. A looping show or another writer can leave the device in
+ * a different state than the previous frame, so the banks are compared
+ * rather than trusted to have changed. */
+static void play_frame(howler_device *dev, unsigned int bank_mask,
+                       const unsigned char *banks) {
+  unsigned int changed = 0;
+  int k = 0;
+  for(; k < 6; k++) {
+    if(!(bank_mask & (1 << k))) {
+      continue;
+    }
+
+    if(memcmp(dev->logical_banks[k], banks, sizeof(howler_led_bank)) != 0) {
+      memcpy(dev->logical_banks[k], banks, sizeof(howler_led_bank));
+      changed |= 1 << k;
+    }
+    banks += sizeof(howler_led_bank);
+  }
+
+  howler_commit_led_banks(dev, changed);
+}
+
+int howler_play_timeline(howler_context *ctx, howler_timeline *tl, int loop) {
+  if(!ctx || !tl || !tl->data) { return HOWLER_ERROR_INVALID_PTR; }
+
+  tl->offset = HOWLER_TIMELINE_HEADER_SIZE;
+  tl->start_ns = howler_get_time_ns();
+
+  // A show without length would replay its first frames forever at once.
+  tl->loop = loop && tl->duration_ns > 0;
+  ctx->timeline = tl;
+
+  howler_pump_timeline(ctx, tl->start_ns);
+  return HOWLER_SUCCESS;
+}
+
+void howler_stop_timeline(howler_context *ctx) {
+  if(ctx) {
+    ctx->timeline = NULL;
+  }
+}
+
+int howler_timeline_playing(const howler_context *ctx) {
+  return ctx && ctx->timeline;
+}
+
+void howler_pump_timeline(howler_context *ctx, uint64_t now_ns) {
+  howler_timeline *tl = ctx->timeline;
+  if(!tl) { return; }
+
+  for(;;) {
+    if(tl->offset >= tl->size) {
+      if(now_ns < tl->start_ns + tl->duration_ns) {
+        return;
+      }
+
+      if(!tl->loop) {
+        ctx->timeline = NULL;
+        return;
+      }
+
+      tl->start_ns += tl->duration_ns;
+      tl->offset = HOWLER_TIMELINE_HEADER_SIZE;
+      continue;
+    }
+
+    const unsigned char *frame = tl->data + tl->offset;
+    size_t remaining = tl->size - tl->offset;
+    if(remaining < HOWLER_TIMELINE_FRAME_HEADER_SIZE ||
+       remaining < frame_size(frame[9])) {
+      fprintf(stderr, "ERROR: Timeline is truncated, playback stopped\n");
+      ctx->timeline = NULL;
+      return;
+    }
+
+    if(tl->start_ns + get_le64(frame) > now_ns) {
+      return;
+    }
+
+    // Frames that came due together are all committed; the pacer merges
+    // the ones the device has no time for.
+    if(frame[8] < ctx->nDevices) {
+      play_frame(&(ctx->devices[frame[8]]), frame[9],
+                 frame + HOWLER_TIMELINE_FRAME_HEADER_SIZE);
+    }
+    tl->offset += frame_size(frame[9]);
+  }
+}
+
+uint64_t howler_next_timeline_deadline(const howler_context *ctx) {
+  const howler_timeline *tl = ctx->timeline;
+  if(!tl) { return 0; }
+
+  if(tl->size - tl->offset < HOWLER_TIMELINE_FRAME_HEADER_SIZE) {
+    return tl->start_ns + tl->duration_ns;
+  }
+
+  return tl->start_ns + get_le64(tl->data + tl->offset);
+}
@@ -0,0 +1,299 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HOWLER_ENABLE_TRACING
+
+// Span buffers are allocated on the heap by every thread that records.
+#ifdef HOWLER_STATIC_ALLOCATION
+#error "Tracing is not available in a static allocation build"
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *
+ * Per-thread buffers
+ *
+ ******************************************************************************/
+
+typedef struct {
+  const char *name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  int arg;
+} span_event;
+
+/* Only the owning thread writes to a buffer. It publishes each event by
+ * bumping count with a release store, so that the exporter can read the
+ * events below count from any thread. Buffers are linked into a list that is
+ * only ever pushed to, and are never freed, since the exporter may still
+ * want the spans of threads that have exited. Instead, a thread keeps its
+ * buffer from one tracing session to the next, and the buffers of exited
+ * threads are taken over by new threads once their session is over, so the
+ * list only grows with the number of threads tracing at the same time. */
+typedef struct span_buffer {
+  struct span_buffer *next;
+  int owned;
+  unsigned int generation;
+  long tid;
+  size_t capacity;
+
+  // Events this session may record, which is at most capacity.
+  size_t limit;
+  size_t count;
+  unsigned long long dropped;
+  span_event events[];
+} span_buffer;
+
+static span_buffer *gBuffers = NULL;
+static int gEnabled = 0;
+static unsigned int gGeneration = 0;
+static size_t gCapacity = 0;
+
+static __thread span_buffer *tBuffer = NULL;
+
+static pthread_key_t gBufferKey;
+static pthread_once_t gBufferKeyOnce = PTHREAD_ONCE_INIT;
+
+static void release_buffer(void *buf) {
+  __atomic_store_n(&(((span_buffer *)buf)->owned), 0, __ATOMIC_RELEASE);
+}
+
+static void create_buffer_key(void) {
+  pthread_key_create(&gBufferKey, release_buffer);
+}
+
+/* Empties buf for the session generation. The count is cleared before the
+ * generation is published, so an exporter that sees the new generation never
+ * reads the events of the previous session. */
+static void reset_buffer(span_buffer *buf, unsigned int generation,
+                         size_t limit) {
+  buf->limit = limit;
+  buf->dropped = 0;
+  __atomic_store_n(&(buf->count), 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&(buf->generation), generation, __ATOMIC_RELEASE);
+}
+
+/* Takes over a buffer of an exited thread that holds no spans of the current
+ * session and fits capacity events. */
+static span_buffer *claim_buffer(unsigned int generation, size_t capacity) {
+  span_buffer *buf = __atomic_load_n(&gBuffers, __ATOMIC_ACQUIRE);
+  for(; buf; buf = buf->next) {
+    int unowned = 0;
+    if(buf->capacity >= capacity &&
+       __atomic_load_n(&(buf->generation), __ATOMIC_ACQUIRE) != generation &&
+       __atomic_compare_exchange_n(&(buf->owned), &unowned, 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return buf;
+    }
+  }
+
+  return NULL;
+}
+
+static span_buffer *thread_buffer(void) {
+  unsigned int generation = __atomic_load_n(&gGeneration, __ATOMIC_ACQUIRE);
+  span_buffer *buf = tBuffer;
+  if(buf && buf->generation == generation) {
+    return buf;
+  }
+
+  size_t capacity = gCapacity;
+  if(buf && buf->capacity >= capacity) {
+    reset_buffer(buf, generation, capacity);
+    return buf;
+  }
+
+  // The buffer is too small for this session, and is left to a thread of a
+  // session that needs less.
+  pthread_once(&gBufferKeyOnce, create_buffer_key);
+  if(buf) {
+    release_buffer(buf);
+  }
+
+  buf = claim_buffer(generation, capacity);
+  if(buf) {
+    buf->tid = syscall(SYS_gettid);
+    reset_buffer(buf, generation, capacity);
+  } else {
+    buf = malloc(sizeof(span_buffer) + capacity * sizeof(span_event));
+    if(!buf) {
+      tBuffer = NULL;
+      pthread_setspecific(gBufferKey, NULL);
+      return NULL;
+    }
+
+    buf->owned = 1;
+    buf->generation = generation;
+    buf->tid = syscall(SYS_gettid);
+    buf->capacity = capacity;
+    buf->limit = capacity;
+    buf->count = 0;
+    buf->dropped = 0;
+
+    buf->next = __atomic_load_n(&gBuffers, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&gBuffers, &(buf->next), buf, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
+  tBuffer = buf;
+  pthread_setspecific(gBufferKey, buf);
+  return buf;
+}
+
+uint64_t howler_span_begin(void) {
+  if(!__atomic_load_n(&gEnabled, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  return howler_get_time_ns();
+}
+
+void howler_span_end(const char *name, uint64_t start_ns, int arg) {
+  // Spans that started before tracing was enabled are not recorded.
+  if(!start_ns || !__atomic_load_n(&gEnabled, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  uint64_t end_ns = howler_get_time_ns();
+  span_buffer *buf = thread_buffer();
+  if(!buf) {
+    return;
+  }
+
+  if(buf->count == buf->limit) {
+    buf->dropped++;
+    return;
+  }
+
+  span_event *event = &(buf->events[buf->count]);
+  event->name = name;
+  event->start_ns = start_ns;
+  event->duration_ns = end_ns - start_ns;
+  event->arg = arg;
+  __atomic_store_n(&(buf->count), buf->count + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+ *
+ * Control and export
+ *
+ ******************************************************************************/
+
+int howler_tracing_start(size_t events_per_thread) {
+  if(events_per_thread == 0) {
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  gCapacity = events_per_thread;
+  __atomic_add_fetch(&gGeneration, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&gEnabled, 1, __ATOMIC_RELEASE);
+  return HOWLER_SUCCESS;
+}
+
+void howler_tracing_stop(void) {
+  __atomic_store_n(&gEnabled, 0, __ATOMIC_RELEASE);
+}
+
+int howler_tracing_write_json(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if(!fp) {
+    fprintf(stderr, "ERROR: Unable to open trace file %s\n", path);
+    return HOWLER_ERROR_INVALID_PARAMS;
+  }
+
+  long pid = (long)getpid();
+  unsigned int generation = __atomic_load_n(&gGeneration, __ATOMIC_ACQUIRE);
+  unsigned long long dropped = 0;
+
+  fprintf(fp, "{\"traceEvents\":[\n");
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,"
+          "\"args\":{\"name\":\"libhowler\"}}", pid);
+
+  span_buffer *buf = __atomic_load_n(&gBuffers, __ATOMIC_ACQUIRE);
+  for(; buf; buf = buf->next) {
+    if(__atomic_load_n(&(buf->generation), __ATOMIC_ACQUIRE) != generation) {
+      continue;
+    }
+
+    size_t count = __atomic_load_n(&(buf->count), __ATOMIC_ACQUIRE);
+    dropped += buf->dropped;
+
+    size_t i = 0;
+    for(; i < count; i++) {
+      const span_event *event = &(buf->events[i]);
+      fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,"
+              "\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+              event->name, pid, buf->tid,
+              (unsigned long long)(event->start_ns / 1000),
+              (unsigned int)(event->start_ns % 1000),
+              (unsigned long long)(event->duration_ns / 1000),
+              (unsigned int)(event->duration_ns % 1000));
+      if(event->arg >= 0) {
+        fprintf(fp, ",\"args\":{\"arg\":%d}", event->arg);
+      }
+      fprintf(fp, "}");
+    }
+  }
+
+  fprintf(fp, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu}}\n",
+          dropped);
+
+  int err = ferror(fp)? HOWLER_ERROR_INVALID_PARAMS : HOWLER_SUCCESS;
+  fclose(fp);
+  return err;
+}
+
+#else  // HOWLER_ENABLE_TRACING
+
+uint64_t howler_span_begin(void) {
+  return 0;
+}
+
+void howler_span_end(const char *name, uint64_t start_ns, int arg) {
+  (void)name;
+  (void)start_ns;
+  (void)arg;
+}
+
+int howler_tracing_start(size_t events_per_thread) {
+  (void)events_per_thread;
+  return HOWLER_ERROR_UNSUPPORTED;
+}
+
+void howler_tracing_stop(void) {
+}
+
+int howler_tracing_write_json(const char *path) {
+  (void)path;
+  return HOWLER_ERROR_UNSUPPORTED;
+}
+
+#endif  // HOWLER_ENABLE_TRACING
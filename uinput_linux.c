@@ -0,0 +1,269 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Pavel Krajcevski
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "howler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+struct howler_uinput_bridge {
+  howler_context *ctx;
+  int *fds;
+  size_t nFds;
+  howler_uinput_stats stats;
+};
+
+#ifdef HOWLER_STATIC_ALLOCATION
+// A static allocation build has room for a single bridge.
+static howler_uinput_bridge gBridge;
+static int gBridgeFds[HOWLER_MAX_DEVICES];
+#endif
+
+static const int kJoystickAxes[HOWLER_NUM_JOYSTICKS][2] = {
+  { ABS_X, ABS_Y },
+  { ABS_RX, ABS_RY },
+  { ABS_HAT0X, ABS_HAT0Y },
+  { ABS_HAT1X, ABS_HAT1Y },
+};
+
+#define NUM_JOYSTICK_BUTTON_CODES (BTN_DEAD - BTN_TRIGGER + 1)
+
+static int button_code(int button_index) {
+  if(button_index < NUM_JOYSTICK_BUTTON_CODES) {
+    return BTN_TRIGGER + button_index;
+  }
+  return BTN_TRIGGER_HAPPY1 + (button_index - NUM_JOYSTICK_BUTTON_CODES);
+}
+
+static int open_uinput_device(unsigned int device_index) {
+  int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+  if(fd < 0) {
+    fprintf(stderr, "ERROR: Unable to open /dev/uinput: %s\n", strerror(errno));
+    return -1;
+  }
+
+  int err = 0;
+  err = err || ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0;
+  err = err || ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0;
+  err = err || ioctl(fd, UI_SET_EVBIT, EV_ABS) < 0;
+
+  int i = 0;
+  for(; i < HOWLER_NUM_BUTTONS; i++) {
+    err = err || ioctl(fd, UI_SET_KEYBIT, button_code(i)) < 0;
+  }
+
+  for(i = 0; i < HOWLER_NUM_JOYSTICKS; i++) {
+    err = err || ioctl(fd, UI_SET_ABSBIT, kJoystickAxes[i][0]) < 0;
+    err = err || ioctl(fd, UI_SET_ABSBIT, kJoystickAxes[i][1]) < 0;
+  }
+
+  if(err) {
+    goto error;
+  }
+
+  struct uinput_user_dev udev;
+  memset(&udev, 0, sizeof(udev));
+  snprintf(udev.name, UINPUT_MAX_NAME_SIZE, "Howler Controller %u", device_index);
+  udev.id.bustype = BUS_USB;
+  udev.id.vendor = HOWLER_VENDOR_ID;
+  udev.id.product = HOWLER_DEVICE_ID[0];
+  udev.id.version = 1;
+
+  for(i = 0; i < HOWLER_NUM_JOYSTICKS; i++) {
+    int k = 0;
+    for(; k < 2; k++) {
+      udev.absmin[kJoystickAxes[i][k]] = -1;
+      udev.absmax[kJoystickAxes[i][k]] = 1;
+    }
+  }
+
+  if(write(fd, &udev, sizeof(udev)) != sizeof(udev)) {
+    goto error;
+  }
+
+  if(ioctl(fd, UI_DEV_CREATE) < 0) {
+    goto error;
+  }
+
+  return fd;
+
+ error:
+  fprintf(stderr, "ERROR: Unable to create uinput device: %s\n", strerror(errno));
+  close(fd);
+  return -1;
+}
+
+static void fill_event(struct input_event *ev, uint64_t time_ns,
+                       unsigned short type, unsigned short code, int value) {
+  ev->time.tv_sec = time_ns / 1000000000ULL;
+  ev->time.tv_usec = (time_ns % 1000000000ULL) / 1000;
+  ev->type = type;
+  ev->code = code;
+  ev->value = value;
+}
+
+static void bridge_report_cb(howler_device *dev, howler_input_mask changed,
+                             howler_input_mask state, uint64_t arrival_ns,
+                             void *user_data) {
+  howler_uinput_bridge *bridge = (howler_uinput_bridge *)user_data;
+  size_t device_index = dev - bridge->ctx->devices;
+  if(device_index >= bridge->nFds) {
+    return;
+  }
+
+  // One event per button and two per joystick at most, plus SYN_REPORT
+  struct input_event events[HOWLER_NUM_BUTTONS + 2*HOWLER_NUM_JOYSTICKS + 1];
+  int nEvents = 0;
+
+  int j = 0;
+  for(; j < HOWLER_NUM_JOYSTICKS; j++) {
+    int up = eHowlerInput_Joystick1Up + 4*j;
+    howler_input_mask vertical = (howler_input_mask)0x3 << up;
+    howler_input_mask horizontal = (howler_input_mask)0xC << up;
+
+    if(changed & horizontal) {
+      int value = (int)((state >> (up + 3)) & 1) - (int)((state >> (up + 2)) & 1);
+      fill_event(&events[nEvents++], arrival_ns, EV_ABS, kJoystickAxes[j][0], value);
+    }
+
+    if(changed & vertical) {
+      int value = (int)((state >> (up + 1)) & 1) - (int)((state >> up) & 1);
+      fill_event(&events[nEvents++], arrival_ns, EV_ABS, kJoystickAxes[j][1], value);
+    }
+  }
+
+  howler_input_mask buttons =
+    (changed >> eHowlerInput_Button1) & ((1ULL << HOWLER_NUM_BUTTONS) - 1);
+  while(buttons) {
+    int b = __builtin_ctzll(buttons);
+    buttons &= buttons - 1;
+
+    int value = (state >> (eHowlerInput_Button1 + b)) & 1;
+    fill_event(&events[nEvents++], arrival_ns, EV_KEY, button_code(b), value);
+  }
+
+  // Accelerometer only reports...
+  if(!nEvents) {
+    return;
+  }
+
+  fill_event(&events[nEvents++], arrival_ns, EV_SYN, SYN_REPORT, 0);
+
+  ssize_t size = nEvents * sizeof(events[0]);
+  if(write(bridge->fds[device_index], events, size) != size) {
+    bridge->stats.write_errors++;
+    return;
+  }
+
+  uint64_t latency = howler_get_time_ns() - arrival_ns;
+  howler_uinput_stats *stats = &(bridge->stats);
+  if(!stats->reports || latency < stats->latency_min_ns) {
+    stats->latency_min_ns = latency;
+  }
+  if(latency > stats->latency_max_ns) {
+    stats->latency_max_ns = latency;
+  }
+  stats->latency_total_ns += latency;
+  stats->reports++;
+  stats->events += nEvents - 1;
+}
+
+int howler_uinput_bridge_create(howler_uinput_bridge **bridge_ptr,
+                                howler_context *ctx) {
+  if(!bridge_ptr || !ctx) { return HOWLER_ERROR_INVALID_PTR; }
+
+#ifdef HOWLER_STATIC_ALLOCATION
+  if(gBridge.ctx) {
+    *bridge_ptr = NULL;
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+
+  howler_uinput_bridge *bridge = &gBridge;
+  memset(bridge, 0, sizeof(*bridge));
+  bridge->ctx = ctx;
+  bridge->fds = gBridgeFds;
+#else
+  howler_uinput_bridge *bridge = malloc(sizeof(howler_uinput_bridge));
+  if(!bridge) {
+    *bridge_ptr = NULL;
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+
+  memset(bridge, 0, sizeof(*bridge));
+  bridge->ctx = ctx;
+  bridge->fds = malloc(ctx->nDevices * sizeof(int));
+  if(!bridge->fds && ctx->nDevices) {
+    free(bridge);
+    *bridge_ptr = NULL;
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+#endif
+
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    int fd = open_uinput_device(i);
+    if(fd < 0) {
+      howler_uinput_bridge_destroy(bridge);
+      *bridge_ptr = NULL;
+      return HOWLER_ERROR_UINPUT_ERROR;
+    }
+    bridge->fds[bridge->nFds++] = fd;
+  }
+
+  howler_set_report_callback(ctx, bridge_report_cb, bridge);
+  *bridge_ptr = bridge;
+  return HOWLER_SUCCESS;
+}
+
+void howler_uinput_bridge_destroy(howler_uinput_bridge *bridge) {
+  if(!bridge) { return; }
+
+  if(bridge->ctx->report_user_data == bridge) {
+    howler_set_report_callback(bridge->ctx, NULL, NULL);
+  }
+
+  unsigned int i = 0;
+  for(; i < bridge->nFds; i++) {
+    ioctl(bridge->fds[i], UI_DEV_DESTROY);
+    close(bridge->fds[i]);
+  }
+
+#ifdef HOWLER_STATIC_ALLOCATION
+  bridge->ctx = NULL;
+#else
+  free(bridge->fds);
+  free(bridge);
+#endif
+}
+
+void howler_uinput_bridge_get_stats(const howler_uinput_bridge *bridge,
+                                    howler_uinput_stats *stats) {
+  if(!bridge || !stats) { return; }
+  *stats = bridge->stats;
+}
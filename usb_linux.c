@@ -27,28 +27,30 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <unistd.h>
 
+// Spans kept per thread when tracing is started through HOWLER_SPANS.
+static const size_t kSpanEventsPerThread = 65536;
 
-static int is_howler(libusb_device *device) {
-  struct libusb_device_descriptor desc;
-  libusb_get_device_descriptor(device, &desc);
+/* Fetches the descriptor of the device and returns whether it is a Howler */
+static int is_howler(libusb_device *device,
+                     struct libusb_device_descriptor *desc) {
+  if(libusb_get_device_descriptor(device, desc) < 0) {
+    return 0;
+  }
 
-  if(desc.idVendor != HOWLER_VENDOR_ID) {
+  if(desc->idVendor != HOWLER_VENDOR_ID) {
     return 0;
   }
 
-  int has_device_id = 0;
   unsigned int i = 0;
   for(; i < MAX_HOWLER_DEVICE_IDS; i++) {
-    if(desc.idProduct == HOWLER_DEVICE_ID[i]) {
-      has_device_id = 1;
+    if(desc->idProduct == HOWLER_DEVICE_ID[i]) {
+      return 1;
     }
   }
 
-  if(!has_device_id) {
-    return 0;
-  }
-  return 1;
+  return 0;
 }
 
 static int howler_read_led(howler_led *out, unsigned char index,
@@ -112,154 +114,591 @@ static int howler_read_leds(howler_device *dev) {
     goto detach;
   }
 
+  // Read every LED in firmware order, which is also the frame order, and
+  // let the frame tables put each channel into its bank.
+  howler_led_frame frame;
   unsigned char led_index = 0;
-  int j = 0;
-
-  // Read Joysticks
-  for(j = 0; j < HOWLER_NUM_JOYSTICKS; j++) {
-    howler_led led;
-    err = howler_read_led(&led, led_index++, handle);
+  for(; led_index < HOWLER_NUM_LEDS; led_index++) {
+    err = howler_read_led(&(frame[led_index]), led_index, handle);
     if(err < 0) {
       goto error;
     }
+  }
+
+  howler_led_frame_to_banks(dev->led_banks, frame);
+
+ error:
+  libusb_release_interface(handle, 0);
+ detach:
+  if(kernel_driver_attached) {
+    libusb_attach_kernel_driver(handle, 0);
+  }
+  return err;
+}
+
+static void input_transfer_cb(struct libusb_transfer *transfer) {
+  // Take the timestamp before anything else so that it reflects the arrival
+  // of the report as closely as possible.
+  uint64_t arrival_ns = howler_get_time_ns();
+
+  howler_device *dev = (howler_device *)(transfer->user_data);
+  if(!dev) {
+    fprintf(stderr, "Invalid initialization of polling thread!\n");
+    exit(1);
+  }
+
+  if(transfer->status == LIBUSB_TRANSFER_COMPLETED && dev->ctx->input_started) {
+    // The report is dispatched by howler_handle_events once libusb returns,
+    // which resubmits the transfer, so that no input callback runs inside
+    // event handling or in the middle of a synchronous command.
+    dev->transfer_stats.transfers++;
+    dev->input_received = 1;
+    dev->input_arrival_ns = arrival_ns;
+  } else if(transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+    dev->transfer_stats.transfers++;
+    dev->transfer_stats.failures++;
+    fprintf(stderr, "Transfer failed: %d\n", transfer->status);
+    dev->ctx->exitFlag = 1;
+  }
+
+  // The transfer is no longer in flight. It is kept for the next start.
+  dev->input_pending = 0;
+}
+
+/* Dispatches the reports received since the last call and polls for the
+ * next ones. */
+static void dispatch_input_reports(howler_context *ctx) {
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    howler_device *dev = &(ctx->devices[i]);
+    if(!dev->input_received) {
+      continue;
+    }
 
-    int k = 0;
-    for(; k < 3; k++) {
-      unsigned char bank = howler_joystick_to_bank[j][k][0];
-      unsigned char led_loc = howler_joystick_to_bank[j][k][1];
-      dev->led_banks[bank][led_loc] = led.channels[k];
+    dev->input_received = 0;
+    struct libusb_transfer *transfer =
+      (struct libusb_transfer *)(dev->input_transfer);
+    if(transfer->actual_length > 0) {
+      howler_process_input_report(dev, transfer->buffer,
+                                  dev->input_arrival_ns);
+    }
+
+    // A callback may have stopped the input, or restarted it.
+    if(!ctx->input_started || dev->input_pending) {
+      continue;
+    }
+
+    if(libusb_submit_transfer(transfer) < 0) {
+      fprintf(stderr, "Error submitting additional libusb transfer\n");
+      continue;
     }
+    dev->input_pending = 1;
   }
+}
+
+static int alloc_input_transfer(howler_device *dev) {
+  struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+  if(!transfer) {
+    fprintf(stderr, "Error allocating libusb_transfer struct.\n");
+    return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+  }
+
+  libusb_fill_interrupt_transfer(
+    transfer,
+    (libusb_device_handle *)(dev->usb_handle),
+    HOWLER_INPUT_ENDPOINT,
+    dev->input_report,
+    sizeof(dev->input_report),
+    input_transfer_cb,
+    dev,
+    0);
+  transfer->flags = 0;
+
+  dev->input_transfer = transfer;
+  return HOWLER_SUCCESS;
+}
 
-  // Read buttons
-  for(j = 0; j < HOWLER_NUM_BUTTONS; j++) {
-    howler_led led;
-    err = howler_read_led(&led, led_index++, handle);
+static int start_device_input(howler_device *dev) {
+  libusb_device_handle *handle = (libusb_device_handle *)(dev->usb_handle);
+  int err = libusb_kernel_driver_active(handle, HOWLER_INPUT_INTERFACE);
+  if(err < 0) {
+    return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+  }
+
+  dev->input_kernel_driver_attached = 0;
+  if(err) {
+    err = libusb_detach_kernel_driver(handle, HOWLER_INPUT_INTERFACE);
     if(err < 0) {
-      goto error;
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
     }
+    dev->input_kernel_driver_attached = 1;
+  }
 
-    int k = 0;
-    for(; k < 3; k++) {
-      unsigned char bank = howler_button_to_bank[j][k][0];
-      unsigned char led_loc = howler_button_to_bank[j][k][1];
-      dev->led_banks[bank][led_loc] = led.channels[k];
-    }
+  err = libusb_claim_interface(handle, HOWLER_INPUT_INTERFACE);
+  if(err < 0) {
+    goto detach;
+  }
+
+  memset(dev->input_report, 0, sizeof(dev->input_report));
+  err = libusb_submit_transfer((struct libusb_transfer *)dev->input_transfer);
+  if(err < 0) {
+    goto release;
+  }
+
+  dev->input_pending = 1;
+  return HOWLER_SUCCESS;
+
+ release:
+  libusb_release_interface(handle, HOWLER_INPUT_INTERFACE);
+ detach:
+  if(dev->input_kernel_driver_attached) {
+    libusb_attach_kernel_driver(handle, HOWLER_INPUT_INTERFACE);
+    dev->input_kernel_driver_attached = 0;
   }
+  return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+}
+
+static void stop_device_input(howler_device *dev) {
+  libusb_device_handle *handle = (libusb_device_handle *)(dev->usb_handle);
+  libusb_release_interface(handle, HOWLER_INPUT_INTERFACE);
+  if(dev->input_kernel_driver_attached) {
+    libusb_attach_kernel_driver(handle, HOWLER_INPUT_INTERFACE);
+    dev->input_kernel_driver_attached = 0;
+  }
+}
+
+int howler_start_input(howler_context *ctx) {
+  if(!ctx) { return HOWLER_ERROR_INVALID_PTR; }
+  if(ctx->input_started) { return HOWLER_SUCCESS; }
+
+  ctx->input_started = 1;
+  ctx->exitFlag = 0;
+
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    // Virtual devices only receive injected reports, and some devices have
+    // no input endpoint to poll.
+    if(!ctx->devices[i].usb_handle ||
+       !(ctx->devices[i].info.capabilities & HOWLER_CAPABILITY_INPUT_ENDPOINT)) {
+      continue;
+    }
 
-  // Read high power LEDs
-  for(j = 0; j < HOWLER_NUM_HIGH_POWER_LEDS; j++) {
-    howler_led led;
-    err = howler_read_led(&led, led_index++, handle);
+    int err = start_device_input(&(ctx->devices[i]));
     if(err < 0) {
-      goto error;
+      howler_stop_input(ctx);
+      return err;
     }
+  }
 
-    int k = 0;
-    for(; k < 3; k++) {
-      unsigned char bank = howler_hp_led_to_bank[j][k][0];
-      unsigned char led_loc = howler_hp_led_to_bank[j][k][1];
-      dev->led_banks[bank][led_loc] = led.channels[k];
+  return HOWLER_SUCCESS;
+}
+
+void howler_stop_input(howler_context *ctx) {
+  if(!ctx || !ctx->input_started) { return; }
+  ctx->input_started = 0;
+
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    if(ctx->devices[i].input_pending) {
+      libusb_cancel_transfer(ctx->devices[i].input_transfer);
     }
   }
- error:
-  libusb_release_interface(handle, 0);
- detach:
-  if(kernel_driver_attached) {
-    libusb_attach_kernel_driver(handle, 0);
+
+  // Wait for the cancellations to come back through the callback.
+  int pending = 1;
+  while(pending) {
+    pending = 0;
+    for(i = 0; i < ctx->nDevices; i++) {
+      pending = pending || ctx->devices[i].input_pending;
+    }
+
+    if(pending && libusb_handle_events(ctx->usb_ctx) < 0) {
+      break;
+    }
+  }
+
+  for(i = 0; i < ctx->nDevices; i++) {
+    ctx->devices[i].input_received = 0;
+    if(ctx->devices[i].usb_handle) {
+      stop_device_input(&(ctx->devices[i]));
+    }
   }
-  return err;
 }
 
-static void async_transfer_cb(struct libusb_transfer *transfer) {
-  howler_context *ctx = (howler_context *)(transfer->user_data);
-  if(!ctx) {
-    fprintf(stderr, "Invalid initialization of polling thread!\n");
-    exit(1);
+uint64_t howler_next_deadline(const howler_context *ctx) {
+  if(!ctx) { return 0; }
+
+  // The next debouncing timer, paced LED frame or timeline frame, or now
+  // when a report is waiting to be dispatched.
+  uint64_t deadline = howler_next_input_deadline(ctx);
+  unsigned int i = 0;
+  for(; i < ctx->nDevices; i++) {
+    const howler_device *dev = &(ctx->devices[i]);
+    if(dev->input_received &&
+       (!deadline || dev->input_arrival_ns < deadline)) {
+      deadline = dev->input_arrival_ns;
+    }
   }
 
-  //  fprintf(stdout, "Async transfer completed:\n");
-  //  int i = 0;
-  //  for(; i < 24; i++) {
-  //    fprintf(stdout, " 0x%x", transfer->buffer[i]);
-  //  }
-  //  fprintf(stdout, "\n");
+  uint64_t frame_deadline = howler_next_led_frame_deadline(ctx);
+  if(frame_deadline && (!deadline || frame_deadline < deadline)) {
+    deadline = frame_deadline;
+  }
 
-  if(transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+  uint64_t timeline_deadline = howler_next_timeline_deadline(ctx);
+  if(timeline_deadline && (!deadline || timeline_deadline < deadline)) {
+    deadline = timeline_deadline;
+  }
 
-    libusb_fill_interrupt_transfer(
-      transfer,
-      transfer->dev_handle,
-      0x83,
-      transfer->buffer,
-      24,
-      async_transfer_cb,
-      ctx,
-      0);
-    transfer->flags = 0;
+  return deadline;
+}
 
-    int error = libusb_submit_transfer(transfer);
-    if(error < 0) {
-      fprintf(stderr, "Error submitting additional libusb transfer\n");
+int howler_handle_events(howler_context *ctx, int timeout_ms) {
+  if(!ctx) { return HOWLER_ERROR_INVALID_PTR; }
+
+  // Don't sleep past the next timer.
+  uint64_t timeout_ns = (uint64_t)timeout_ms * 1000000ULL;
+  uint64_t deadline = howler_next_deadline(ctx);
+  if(deadline) {
+    uint64_t now = howler_get_time_ns();
+    uint64_t until_deadline = (deadline > now)? deadline - now : 0;
+    if(until_deadline < timeout_ns) {
+      timeout_ns = until_deadline;
     }
-  } else {
-    printf("Transfer failed: %d\n", transfer->status);
-    ctx->exitFlag = 1;
   }
+
+  // Nothing to wait on without hardware, and nothing to do when the
+  // application handles the events itself.
+  if(ctx->usb_ctx && !ctx->external_events) {
+    struct timeval tv;
+    tv.tv_sec = timeout_ns / 1000000000ULL;
+    tv.tv_usec = (timeout_ns % 1000000000ULL) / 1000;
+
+    int err = libusb_handle_events_timeout_completed(ctx->usb_ctx, &tv, NULL);
+    if(err < 0 && err != LIBUSB_ERROR_INTERRUPTED) {
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+  }
+
+  dispatch_input_reports(ctx);
+
+  if(deadline) {
+    uint64_t now = howler_get_time_ns();
+    howler_process_input_timers(ctx, now);
+    howler_pump_timeline(ctx, now);
+    howler_pump_led_frames(ctx, now);
+  }
+
+  return HOWLER_SUCCESS;
 }
 
-int howler_init(howler_context **ctx_ptr) {
-  // Convenience variables
-  unsigned int i;
+static howler_context *create_context(howler_arena *arena,
+                                      libusb_context *usb_ctx,
+                                      howler_device *devices,
+                                      size_t nDevices) {
+  howler_context *result = howler_alloc_context(arena);
+  if(!result) {
+    return NULL;
+  }
 
-  // First, check if the pointer is valid...
-  int error = HOWLER_SUCCESS;
+  result->usb_ctx = usb_ctx;
+  result->owns_usb_ctx = 1;
+  result->nDevices = nDevices;
+  result->devices = devices;
+
+  unsigned int i = 0;
+  for(; i < nDevices; i++) {
+    devices[i].ctx = result;
+  }
+
+  const char *trace_path = getenv("HOWLER_TRACE");
+  if(trace_path && trace_path[0]) {
+    howler_start_recording(result, trace_path);
+  }
+
+  return result;
+}
+
+int howler_init_virtual(howler_context **ctx_ptr, size_t nDevices) {
   if(!ctx_ptr) { return HOWLER_ERROR_INVALID_PTR; }
 
-  // Allocate a USB context so that we can talk to the devices...
-  libusb_context *usb_ctx;
-  int ret = libusb_init(&usb_ctx);
-  if(ret) {
-    error = HOWLER_ERROR_LIBUSB_CONTEXT_ERROR;
-    goto err;
+  howler_arena *arena = NULL;
+#ifdef HOWLER_STATIC_ALLOCATION
+  arena = howler_acquire_arena(NULL);
+  if(!arena) {
+    *ctx_ptr = NULL;
+    return HOWLER_ERROR_OUT_OF_MEMORY;
   }
+#endif
 
-  libusb_set_debug(usb_ctx, 3);
+  howler_device *devices = howler_alloc_devices(arena, &nDevices);
+  if(!devices) {
+    *ctx_ptr = NULL;
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
 
-  // Get a list of all available devices.
-  libusb_device **device_list;
-  ssize_t nDevices = libusb_get_device_list(usb_ctx, &device_list);
-  if(nDevices < 0) {
-    error = HOWLER_ERROR_LIBUSB_DEVICE_LIST_ERROR;
-    goto err_after_libusb_context;
+  unsigned int i = 0;
+  for(; i < nDevices; i++) {
+    devices[i].sys_fd = -1;
+    howler_led_transform_init(&(devices[i].led_transform));
+    howler_brightness_init(&(devices[i].brightness));
   }
 
-  // Find which ones are howlers...
-  size_t nHowlers = 0;
-  for(i = 0; i < nDevices; i++) {
-    if(is_howler(device_list[i])) {
-      nHowlers++;
+  *ctx_ptr = create_context(arena, NULL, devices, nDevices);
+  if(!*ctx_ptr) {
+    howler_free_devices(arena, devices);
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+  return HOWLER_SUCCESS;
+}
+
+/* Fills in the sysfs style bus path of an enumerated device */
+static void get_bus_path(libusb_device *device, char *dst, size_t dst_size) {
+  uint8_t ports[8];
+  int nPorts = libusb_get_port_numbers(device, ports, sizeof(ports));
+  int len = snprintf(dst, dst_size, "%u", libusb_get_bus_number(device));
+
+  int i = 0;
+  for(; i < nPorts && len < (int)dst_size; i++) {
+    len += snprintf(dst + len, dst_size - len, "%c%u", (i == 0)? '-' : '.',
+                    ports[i]);
+  }
+}
+
+static int query_firmware_version(howler_device *dev) {
+  unsigned char cmd_buf[24];
+  memset(cmd_buf, 0, sizeof(cmd_buf));
+
+  unsigned char output[24];
+  memset(output, 0, sizeof(output));
+
+  cmd_buf[0] = CMD_HOWLER_ID;
+  cmd_buf[1] = CMD_GET_FW_REV;
+
+  int err = howler_sendrcv(dev, cmd_buf, output);
+  if(err < 0 || output[0] != CMD_HOWLER_ID || output[1] != CMD_GET_FW_REV) {
+    return -1;
+  }
+
+  dev->info.firmware_major = output[2];
+  dev->info.firmware_minor = output[3];
+  dev->info.capabilities |= HOWLER_CAPABILITY_FIRMWARE_VERSION;
+  return 0;
+}
+
+static void read_serial_number(howler_device_info *info,
+                               libusb_device_handle *h,
+                               uint8_t serial_index) {
+  info->serial[0] = '\0';
+  if(!serial_index) {
+    return;
+  }
+
+  int len = libusb_get_string_descriptor_ascii(
+    h, serial_index, (unsigned char *)info->serial, sizeof(info->serial));
+  if(len <= 0) {
+    info->serial[0] = '\0';
+    return;
+  }
+
+  // Keep it to one word for the device cache.
+  int i = 0;
+  for(; i < len && info->serial[i]; i++) {
+    if(info->serial[i] <= ' ' || info->serial[i] > '~') {
+      info->serial[i] = '_';
     }
   }
+  info->serial[len < HOWLER_SERIAL_SIZE? len : HOWLER_SERIAL_SIZE - 1] = '\0';
+  info->capabilities |= HOWLER_CAPABILITY_SERIAL_NUMBER;
+}
 
-  // Short circuit if no howlers...
-  if(!nHowlers) {
-    howler_context *result = malloc(sizeof(howler_context));
-    result->usb_ctx = usb_ctx;
-    result->nDevices = nHowlers;
-    result->devices = NULL;
-    *ctx_ptr = result;
+static int has_input_endpoint(libusb_device_handle *h) {
+  struct libusb_config_descriptor *config;
+  if(libusb_get_active_config_descriptor(libusb_get_device(h), &config) < 0) {
+    return 0;
   }
 
-  howler_device *howlers = malloc(nHowlers * sizeof(howler_device));
-  unsigned int howler_idx = 0;
-  for(i = 0; i < nDevices; i++) {
-    if(!is_howler(device_list[i]))
-      continue;
+  int found = 0;
+  int i = 0;
+  for(; i < config->bNumInterfaces && !found; i++) {
+    const struct libusb_interface *iface = &(config->interface[i]);
+    int alt = 0;
+    for(; alt < iface->num_altsetting && !found; alt++) {
+      const struct libusb_interface_descriptor *desc = &(iface->altsetting[alt]);
+      int e = 0;
+      for(; e < desc->bNumEndpoints; e++) {
+        if(desc->bInterfaceNumber == HOWLER_INPUT_INTERFACE &&
+           desc->endpoint[e].bEndpointAddress == HOWLER_INPUT_ENDPOINT) {
+          found = 1;
+        }
+      }
+    }
+  }
+
+  libusb_free_config_descriptor(config);
+  return found;
+}
+
+/* Brings a freshly opened device up to date with its hardware state */
+static int setup_device(howler_device *howler, libusb_device_handle *h,
+                        int fd, const howler_device_info *info) {
+  memset(howler, 0, sizeof(*howler));
+  howler->usb_handle = h;
+  howler->sys_fd = fd;
+  howler->info = *info;
+  howler_led_transform_init(&(howler->led_transform));
+  howler_brightness_init(&(howler->brightness));
+
+  howler->info.capabilities &= ~HOWLER_CAPABILITY_INPUT_ENDPOINT;
+  if(has_input_endpoint(h)) {
+    howler->info.capabilities |= HOWLER_CAPABILITY_INPUT_ENDPOINT;
+  }
+
+  // Every transfer the device will need is allocated up front, so that
+  // nothing is allocated once the context is running.
+  int err = howler_alloc_command_transfers(howler);
+  if(err == HOWLER_SUCCESS &&
+     (howler->info.capabilities & HOWLER_CAPABILITY_INPUT_ENDPOINT)) {
+    err = alloc_input_transfer(howler);
+  }
+  if(err < 0) {
+    return err;
+  }
+
+  HOWLER_SPAN_BEGIN(read_leds_span);
+  err = howler_read_leds(howler);
+  HOWLER_SPAN_END(read_leds_span, "read_leds", -1);
+  if(err < 0) {
+    fprintf(stderr, "WARNING: Unable to read LEDs during initialization\n");
+    return err;
+  }
+
+  // There's no correction applied until the application asks for it.
+  memcpy(howler->logical_banks, howler->led_banks, sizeof(howler->led_banks));
+  return HOWLER_SUCCESS;
+}
+
+static void close_device(howler_device *dev) {
+  howler_free_command_transfers(dev);
+  if(dev->input_transfer) {
+    libusb_free_transfer((struct libusb_transfer *)dev->input_transfer);
+    dev->input_transfer = NULL;
+  }
+
+  libusb_close((libusb_device_handle *)dev->usb_handle);
+  if(dev->sys_fd >= 0) {
+    close(dev->sys_fd);
+  }
+}
 
-    libusb_device *d = device_list[i];
+/* Opens every device in the cache. Returns the number opened, or 0 if any
+ * of them is missing or no longer matches, in which case nothing is left
+ * open. */
+static size_t open_cached_devices(libusb_context *usb_ctx,
+                                  howler_device *howlers,
+                                  const howler_device_info *cached,
+                                  size_t nCached) {
+  size_t i = 0;
+  for(; i < nCached; i++) {
     libusb_device_handle *h = NULL;
-    int err = libusb_open(d, &h);
+    int fd = -1;
+
+    HOWLER_SPAN_BEGIN(open_span);
+    int err = howler_open_bus_path(usb_ctx, cached[i].bus_path, &h, &fd);
+    HOWLER_SPAN_END(open_span, "open", (int)i);
+    if(err < 0) {
+      break;
+    }
+
+    // Whatever is plugged in there now has to be the same kind of Howler.
+    struct libusb_device_descriptor desc;
+    if(libusb_get_device_descriptor(libusb_get_device(h), &desc) < 0 ||
+       desc.idVendor != HOWLER_VENDOR_ID ||
+       desc.idProduct != cached[i].product_id) {
+      libusb_close(h);
+      close(fd);
+      break;
+    }
+
+    if(setup_device(&(howlers[i]), h, fd, &(cached[i])) < 0) {
+      close_device(&(howlers[i]));
+      break;
+    }
+
+    // Reflashing a board leaves its bus path and product alone, so the
+    // cached firmware version is dropped and read again when it is asked
+    // for.
+    howlers[i].info.capabilities &= ~HOWLER_CAPABILITY_FIRMWARE_VERSION;
+  }
+
+  if(i == nCached) {
+    return nCached;
+  }
+
+  while(i-- > 0) {
+    close_device(&(howlers[i]));
+  }
+  return 0;
+}
+
+/* Opens the Howlers among the devices of device_list, or of the whole bus
+ * when device_list is NULL. */
+static int scan_devices(howler_arena *arena, libusb_context *usb_ctx,
+                        libusb_device **device_list, ssize_t nDevices,
+                        howler_device **howlers_ptr, size_t *nHowlers_ptr) {
+  HOWLER_SPAN_BEGIN(enumerate_span);
+  int owns_list = (device_list == NULL);
+  if(owns_list) {
+    nDevices = libusb_get_device_list(usb_ctx, &device_list);
+    if(nDevices < 0) {
+      return HOWLER_ERROR_LIBUSB_DEVICE_LIST_ERROR;
+    }
+  }
+
+#ifdef HOWLER_STATIC_ALLOCATION
+  // Only as many Howlers as the arena holds are opened.
+  libusb_device *matches[HOWLER_MAX_DEVICES + 1];
+  struct libusb_device_descriptor descs[HOWLER_MAX_DEVICES + 1];
+  size_t maxMatches = HOWLER_MAX_DEVICES;
+#else
+  libusb_device **matches = malloc((nDevices + 1) * sizeof(libusb_device *));
+  struct libusb_device_descriptor *descs =
+    malloc((nDevices + 1) * sizeof(struct libusb_device_descriptor));
+  size_t maxMatches = (size_t)nDevices;
+  if(!matches || !descs) {
+    free(matches);
+    free(descs);
+    if(owns_list) {
+      libusb_free_device_list(device_list, 1);
+    }
+    return HOWLER_ERROR_OUT_OF_MEMORY;
+  }
+#endif
+
+  size_t nMatches = 0;
+  ssize_t i = 0;
+  for(; i < nDevices && nMatches < maxMatches; i++) {
+    if(is_howler(device_list[i], &(descs[nMatches]))) {
+      matches[nMatches] = device_list[i];
+      nMatches++;
+    }
+  }
+  HOWLER_SPAN_END(enumerate_span, "enumerate", (int)nMatches);
+
+  int error = HOWLER_SUCCESS;
+  howler_device *howlers = howler_alloc_devices(arena, &nMatches);
+  if(!howlers) {
+    error = HOWLER_ERROR_OUT_OF_MEMORY;
+    nMatches = 0;
+  }
+
+  size_t nHowlers = 0;
+  size_t m = 0;
+  for(; m < nMatches; m++) {
+    libusb_device_handle *h = NULL;
+    HOWLER_SPAN_BEGIN(open_span);
+    int err = libusb_open(matches[m], &h);
+    HOWLER_SPAN_END(open_span, "open", (int)m);
     if(err < 0) {
       if(err == LIBUSB_ERROR_ACCESS) {
         fprintf(stderr,
@@ -268,78 +707,163 @@ int howler_init(howler_context **ctx_ptr) {
       }
 
       // Just skip this device...
-      nHowlers--;
       continue;
     }
-    
-    assert(howler_idx < nHowlers);
-    howler_device *howler = &(howlers[howler_idx]);
-    howler->usb_handle = h;
-    memset(howler->led_banks, 0, 6*sizeof(howler_led_bank));
 
-    if(howler_read_leds(howler) < 0) {
-      fprintf(stderr, "WARNING: Unable to read LEDs during initialization\n");
-      nHowlers--;
+    howler_device_info info;
+    memset(&info, 0, sizeof(info));
+    info.product_id = descs[m].idProduct;
+    get_bus_path(matches[m], info.bus_path, sizeof(info.bus_path));
+    read_serial_number(&info, h, descs[m].iSerialNumber);
+
+    howler_device *howler = &(howlers[nHowlers]);
+    if(setup_device(howler, h, -1, &info) < 0) {
+      close_device(howler);
       continue;
     }
 
-    howler_idx++;
+    if(query_firmware_version(howler) < 0) {
+      fprintf(stderr, "WARNING: Unable to read Howler firmware version\n");
+    }
+
+    nHowlers++;
   }
 
-  assert(howler_idx == nHowlers);
+#ifndef HOWLER_STATIC_ALLOCATION
+  free(matches);
+  free(descs);
+#endif
+  if(owns_list) {
+    libusb_free_device_list(device_list, 1);
+  }
 
-  // Everything is OK...
-  howler_context *result = malloc(sizeof(howler_context));
-  result->usb_ctx = usb_ctx;
-  result->nDevices = nHowlers;
-  result->devices = howlers;
-
-  result->key_down_callback = NULL;
-  result->key_up_callback = NULL;
-#if 0
-  // Setup polling thread
-  struct libusb_transfer *polling = libusb_alloc_transfer(0);
-  if(!polling) {
-    fprintf(stderr, "Error allocating libusb_transfer struct.\n");
-    error = -1;
-    goto err_after_libusb_context;
+  *howlers_ptr = howlers;
+  *nHowlers_ptr = nHowlers;
+  return error;
+}
+
+int howler_init(howler_context **ctx_ptr) {
+  return howler_init_with_options(ctx_ptr, NULL);
+}
+
+int howler_init_with_options(howler_context **ctx_ptr,
+                             const howler_init_options *options) {
+  // First, check if the pointer is valid...
+  int error = HOWLER_SUCCESS;
+  if(!ctx_ptr) { return HOWLER_ERROR_INVALID_PTR; }
+
+  howler_init_options defaults;
+  if(!options) {
+    memset(&defaults, 0, sizeof(defaults));
+    options = &defaults;
   }
 
-  char *transferBuffer = malloc(24);
-  memset(transferBuffer, 0, 24);
+  const char *span_path = getenv("HOWLER_SPANS");
+  int tracing = 0;
+  if(span_path && span_path[0]) {
+    tracing = (howler_tracing_start(kSpanEventsPerThread) == HOWLER_SUCCESS);
+    if(!tracing) {
+      fprintf(stderr, "WARNING: HOWLER_SPANS is set, but libhowler was built "
+              "without HOWLER_TRACING\n");
+    }
+  }
 
-  libusb_fill_interrupt_transfer(
-    polling,
-    (libusb_device_handle *)(howlers[0].usb_handle),
-    0x83,
-    transferBuffer,
-    24,
-    async_transfer_cb,
-    result,
-    0);
-  polling->flags = 0;
+  HOWLER_SPAN_BEGIN(init_span);
+  uint64_t init_start_ns = howler_get_time_ns();
 
-  error = libusb_submit_transfer(polling);
-  if(error < 0) {
-    free(transferBuffer);
-    libusb_free_transfer(polling);
-    goto err_after_libusb_context;
+  howler_arena *arena = NULL;
+#ifdef HOWLER_STATIC_ALLOCATION
+  arena = howler_acquire_arena(options->arena);
+  if(!arena) {
+    *ctx_ptr = NULL;
+    return HOWLER_ERROR_OUT_OF_MEMORY;
   }
+#endif
+
+  // Allocate a USB context so that we can talk to the devices, unless the
+  // application shares its own.
+  libusb_context *usb_ctx = options->usb_ctx;
+  int owns_usb_ctx = (usb_ctx == NULL);
+  if(owns_usb_ctx) {
+    int ret = libusb_init(&usb_ctx);
+    if(ret) {
+      error = HOWLER_ERROR_LIBUSB_CONTEXT_ERROR;
+      goto err_after_arena;
+    }
 
-  result->polling = polling;
-  result->exitFlag = 0;
+    // libusb formats nothing below its log level, so the transfer paths stay
+    // free of logging unless it is asked for.
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000106)
+    libusb_set_option(usb_ctx, LIBUSB_OPTION_LOG_LEVEL, options->log_level);
+#else
+    libusb_set_debug(usb_ctx, options->log_level);
 #endif
-  *ctx_ptr = result;
+  }
 
-  // Cleanup
-  libusb_free_device_list(device_list, 1);
+  // The application's device list saves scanning the bus, and otherwise the
+  // devices found last time are tried first.
+  howler_device_info cached[HOWLER_MAX_CACHED_DEVICES];
+  int nCached = 0;
+  if(!options->device_list) {
+    nCached = howler_device_cache_load(cached, HOWLER_MAX_CACHED_DEVICES);
+  }
+
+  howler_device *howlers = NULL;
+  size_t nHowlers = 0;
+  if(nCached > 0) {
+    size_t nAlloc = (size_t)nCached;
+    howlers = howler_alloc_devices(arena, &nAlloc);
+    if(howlers) {
+      nHowlers = open_cached_devices(usb_ctx, howlers, cached, nAlloc);
+    }
+    if(howlers && !nHowlers) {
+      howler_free_devices(arena, howlers);
+      howlers = NULL;
+    }
+  }
+
+  int scanned = 0;
+  if(!howlers) {
+    error = scan_devices(arena, usb_ctx, options->device_list,
+                         (ssize_t)options->nDevices, &howlers, &nHowlers);
+    if(error < 0) {
+      goto err_after_libusb_context;
+    }
+    scanned = !options->device_list;
+  }
+
+  // Everything is OK...
+  *ctx_ptr = create_context(arena, usb_ctx, howlers, nHowlers);
+  if(!*ctx_ptr) {
+    error = HOWLER_ERROR_OUT_OF_MEMORY;
+    goto err_after_devices;
+  }
+  (*ctx_ptr)->owns_usb_ctx = owns_usb_ctx;
+  (*ctx_ptr)->external_events = options->external_events;
+  (*ctx_ptr)->span_trace_path = tracing? span_path : NULL;
+  if(scanned) {
+    howler_device_cache_save(*ctx_ptr);
+  }
+  (*ctx_ptr)->init_ns = howler_get_time_ns() - init_start_ns;
+
+  HOWLER_SPAN_END(init_span, "init", (int)nHowlers);
   return HOWLER_SUCCESS;
 
   // Errors...
+ err_after_devices:
+  while(nHowlers-- > 0) {
+    close_device(&(howlers[nHowlers]));
+  }
+  howler_free_devices(arena, howlers);
  err_after_libusb_context:
-  libusb_free_device_list(device_list, 1);
-  libusb_exit(usb_ctx);
- err:
+  if(owns_usb_ctx) {
+    libusb_exit(usb_ctx);
+  }
+ err_after_arena:
+  howler_release_arena(arena);
+  if(tracing) {
+    howler_tracing_stop();
+  }
   *ctx_ptr = NULL;
   return error;
 }
@@ -347,25 +871,32 @@ int howler_init(howler_context **ctx_ptr) {
 void howler_destroy(howler_context *ctx) {
   if(!ctx) { return; }
 
-#if 0
-  struct libusb_transfer *polling = (struct libusb_transfer *)(ctx->polling);
-  libusb_cancel_transfer(polling);
-  libusb_free_transfer(polling);
-#endif
+  howler_stop_input(ctx);
 
   unsigned int i = 0;
   for(; i < ctx->nDevices; i++) {
-    libusb_close(ctx->devices[i].usb_handle);
+    if(ctx->devices[i].usb_handle) {
+      howler_cancel_commands(&(ctx->devices[i]));
+      close_device(&(ctx->devices[i]));
+    }
   }
-  free(ctx->devices);
+  howler_stop_recording(ctx);
 
-  libusb_exit(ctx->usb_ctx);
-  free(ctx);
+  if(ctx->span_trace_path) {
+    howler_tracing_stop();
+    howler_tracing_write_json(ctx->span_trace_path);
+  }
+
+  if(ctx->usb_ctx && ctx->owns_usb_ctx) {
+    libusb_exit(ctx->usb_ctx);
+  }
+  howler_free_context(ctx);
 }
 
-int howler_sendrcv(howler_device *dev,
-                   unsigned char *cmd_buf,
-                   unsigned char *output) {
+/* Sends a command with blocking transfers, for devices that are still being
+ * opened and have no context to handle events through yet. */
+static int sendrcv_direct(howler_device *dev, unsigned char *cmd_buf,
+                          unsigned char *output) {
   // Claim the interface. Make sure the kernel driver is not attached 
   // first, however.
   libusb_device_handle *handle = (libusb_device_handle *)(dev->usb_handle);
@@ -390,15 +921,23 @@ int howler_sendrcv(howler_device *dev,
 
   // Write the command
   int transferred = 0;
+  uint64_t start_ns = howler_get_time_ns();
   err = libusb_interrupt_transfer(handle, 0x02, cmd_buf, 24, &transferred, 0);
+  howler_record_frame(dev, HOWLER_TRACE_COMMAND, start_ns, err, cmd_buf);
+  dev->transfer_stats.transfers++;
   if(err < 0) {
+    dev->transfer_stats.failures++;
     goto error;
   }
 
   // Read the following command
   if(output) {
     err = libusb_interrupt_transfer(handle, 0x81, output, 24, &transferred, 0);
+    howler_record_frame(dev, HOWLER_TRACE_RESPONSE, howler_get_time_ns(), err,
+                        output);
+    dev->transfer_stats.transfers++;
     if(err < 0) {
+      dev->transfer_stats.failures++;
       goto error;
     }
   }
@@ -411,3 +950,86 @@ int howler_sendrcv(howler_device *dev,
   }
   return err;
 }
+
+/* State of one howler_sendrcv call, which its command carries as user_data.
+ * It lives on the stack of the call, so that a call made while another one
+ * waits cannot disturb it. */
+typedef struct {
+  int done;
+  int status;
+  unsigned char *output;
+} sync_command;
+
+static void sync_command_done(howler_device *dev, int status,
+                              const unsigned char *response, void *user_data) {
+  (void)dev;
+  sync_command *sync = (sync_command *)user_data;
+  if(response && sync->output) {
+    memcpy(sync->output, response, HOWLER_COMMAND_SIZE);
+  }
+  sync->status = status;
+  sync->done = 1;
+}
+
+/* Handles events until the command carrying sync completes. When the wait
+ * fails, e.g. because it was called from inside event handling, the command
+ * is detached from sync, which is about to go out of scope. */
+static int wait_for_sync_command(howler_device *dev, sync_command *sync) {
+  libusb_context *usb_ctx = (libusb_context *)(dev->ctx->usb_ctx);
+  while(!sync->done) {
+    int err = libusb_handle_events_completed(usb_ctx, &(sync->done));
+    if(err < 0 && err != LIBUSB_ERROR_INTERRUPTED && !sync->done) {
+      howler_command_queue_forget(&(dev->commands), sync);
+      return HOWLER_ERROR_LIBUSB_TRANSFER_ERROR;
+    }
+  }
+
+  return sync->status;
+}
+
+int howler_sendrcv(howler_device *dev,
+                   unsigned char *cmd_buf,
+                   unsigned char *output) {
+  if(!dev || !dev->usb_handle || !cmd_buf) {
+    return HOWLER_ERROR_INVALID_PTR;
+  }
+
+  if(!dev->ctx) {
+    return sendrcv_direct(dev, cmd_buf, output);
+  }
+
+  HOWLER_SPAN_BEGIN(span);
+
+  // The command goes through the queue in its own priority class, so that
+  // it only waits for the command on the wire and for queued commands that
+  // outrank it, rather than for everything queued. Readbacks still wait for
+  // every older write, which the queue takes care of.
+  howler_command_priority priority = howler_command_default_priority(cmd_buf);
+  sync_command sync;
+  sync.done = 0;
+  sync.status = HOWLER_SUCCESS;
+  sync.output = output;
+
+  int err;
+  for(;;) {
+    err = howler_submit_command_with_priority(dev, priority, cmd_buf,
+                                              output != NULL,
+                                              sync_command_done, &sync);
+    if(err != HOWLER_ERROR_QUEUE_FULL) {
+      break;
+    }
+
+    err = howler_wait_for_queue_space(dev, priority);
+    if(err < 0) {
+      break;
+    }
+  }
+
+  if(err >= 0) {
+    err = wait_for_sync_command(dev, &sync);
+  }
+  sync.output = NULL;
+
+  HOWLER_SPAN_END(span, "sendrcv", cmd_buf[1]);
+  return err;
+}